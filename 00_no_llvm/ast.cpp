@@ -33,6 +33,30 @@ std::string CallExprAST::src_show() const {
 	return res;
 }
 
+std::string IfThenElseExprAST::src_show() const {
+	return "if " + m_cond->src_show() + " then " + m_thenExpr->src_show() + " else " + m_elseExpr->src_show();
+}
+
+std::string ForExprAST::src_show() const {
+	std::string res = "for " + m_varName + " = " + m_init->src_show() + ", " + m_cond->src_show();
+	if (m_step) res += ", " + m_step->src_show();
+	return res + " in " + m_body->src_show();
+}
+
+std::string WhileExprAST::src_show() const {
+	return "while " + m_cond->src_show() + " do " + m_body->src_show();
+}
+
+std::string VarDefExprAST::src_show() const {
+	std::string res = "var ";
+	for (unsigned i = 0; i < m_varDeclDefs.size(); ++i) {
+		if (i > 0) res += ", ";
+		res += m_varDeclDefs[i].first;
+		if (m_varDeclDefs[i].second) res += " = " + m_varDeclDefs[i].second->src_show();
+	}
+	return res + " in (" + m_innerExpr->src_show() + ")";
+}
+
 std::string PrototypeAST::src_show() const {
 	std::string res = this->m_name;
 
@@ -4,14 +4,15 @@
 #include <vector>
 #include <string>
 
-//#include "llvm/IR/IRBuilder.h"
-//#include "llvm/IR/Module.h"
-//#include "llvm/IR/Verifier.h"
+class FunctionCompiler;
 
 class ExprAST {
 public:
 	virtual ~ExprAST() {}
 	virtual std::string src_show() const = 0;
+	/// Emits the bytecode of the expression, returns the register holding
+	/// its value ('tail' if the value is returned right after).
+	virtual unsigned compile(FunctionCompiler& fc, bool tail) const = 0;
 };
 
 class NumberExprAST : public ExprAST {
@@ -20,6 +21,7 @@ public:
 		: m_val(val)
 	{}
 	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
 
 private:
 	double m_val;
@@ -31,6 +33,9 @@ public:
 		: m_name(name)
 	{}
 	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
+
+	const std::string& name() const { return m_name; }
 
 private:
 	std::string m_name;
@@ -41,7 +46,12 @@ public:
 	BinaryExprAST(char op, ExprAST *left, ExprAST *right)
 		: m_op(op), m_left(left), m_right(right)
 	{}
+	~BinaryExprAST() {
+		delete m_left;
+		delete m_right;
+	}
 	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
 
 private:
 	BinaryExprAST(const BinaryExprAST&);
@@ -59,6 +69,7 @@ public:
 		for (auto e : m_exps) delete e;
 	}
 	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
 
 private:
 	CallExprAST(CallExprAST&);
@@ -67,6 +78,91 @@ private:
 	std::vector<ExprAST*> m_exps;
 };
 
+class IfThenElseExprAST : public ExprAST {
+public:
+	IfThenElseExprAST(ExprAST* cond, ExprAST* thenExpr, ExprAST* elseExpr)
+		: m_cond(cond), m_thenExpr(thenExpr), m_elseExpr(elseExpr)
+	{}
+	~IfThenElseExprAST() {
+		delete m_cond;
+		delete m_thenExpr;
+		delete m_elseExpr;
+	}
+	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
+
+private:
+	IfThenElseExprAST(const IfThenElseExprAST&);
+	IfThenElseExprAST& operator=(const IfThenElseExprAST&);
+	ExprAST* m_cond;
+	ExprAST* m_thenExpr;
+	ExprAST* m_elseExpr;
+};
+
+class ForExprAST : public ExprAST {
+public:
+	ForExprAST(std::string varName, ExprAST* init, ExprAST* cond, ExprAST* step, ExprAST* body)
+		: m_varName(varName), m_init(init), m_cond(cond), m_step(step), m_body(body)
+	{}
+	~ForExprAST() {
+		delete m_init;
+		delete m_cond;
+		delete m_step;
+		delete m_body;
+	}
+	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
+
+private:
+	ForExprAST(const ForExprAST&);
+	ForExprAST& operator=(const ForExprAST&);
+	std::string m_varName;
+	ExprAST* m_init;
+	ExprAST* m_cond;
+	/// nullptr for a step of 1.0
+	ExprAST* m_step;
+	ExprAST* m_body;
+};
+
+class WhileExprAST : public ExprAST {
+public:
+	WhileExprAST(ExprAST* cond, ExprAST* body)
+		: m_cond(cond), m_body(body)
+	{}
+	~WhileExprAST() {
+		delete m_cond;
+		delete m_body;
+	}
+	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
+
+private:
+	WhileExprAST(const WhileExprAST&);
+	WhileExprAST& operator=(const WhileExprAST&);
+	ExprAST* m_cond;
+	ExprAST* m_body;
+};
+
+class VarDefExprAST : public ExprAST {
+public:
+	VarDefExprAST(std::vector<std::pair<std::string, ExprAST*> > varDeclDefs, ExprAST* innerExpr)
+		: m_varDeclDefs(varDeclDefs), m_innerExpr(innerExpr)
+	{}
+	~VarDefExprAST() {
+		for (auto& ex : m_varDeclDefs) delete ex.second;
+		delete m_innerExpr;
+	}
+	std::string src_show() const;
+	unsigned compile(FunctionCompiler& fc, bool tail) const;
+
+private:
+	VarDefExprAST(const VarDefExprAST&);
+	VarDefExprAST& operator=(const VarDefExprAST&);
+	/// Initial values are nullptr for 0
+	std::vector<std::pair<std::string, ExprAST*> > m_varDeclDefs;
+	ExprAST* m_innerExpr;
+};
+
 class PrototypeAST {
 public:
 	PrototypeAST(std::string name, std::vector<std::string> args)
@@ -74,6 +170,7 @@ public:
 	{}
 
 	std::string name() const { return m_name; }
+	const std::vector<std::string>& args() const { return m_args; }
 	std::string src_show() const;
 
 private:
@@ -90,8 +187,11 @@ public:
 	~FunctionAST() {
 		delete m_definition;
 	}
+	const PrototypeAST& proto() const { return m_proto; }
+	const ExprAST& definition() const { return *m_definition; }
 	std::string src_show() const;
-	
+
+
 private:
 	FunctionAST(const FunctionAST&);
 	FunctionAST& operator=(const FunctionAST&);
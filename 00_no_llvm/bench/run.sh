@@ -0,0 +1,30 @@
+#!/bin/sh
+# Compares the bytecode VM with the JIT of 05_while_loop (build both first):
+# startup, the wall time of a single trivial expression, then the time of
+# every top-level expression of ../05_while_loop/bench/fib.kal (fib(32),
+# then 10^6 calls of fibi(60)) in the VM and in the JIT at -O0 and -O2.
+cd "$(dirname "$0")/.." || exit 1
+JIT=../05_while_loop/kaleidoscope
+FIB=../05_while_loop/bench/fib.kal
+
+# Wall time of a command in ms
+elapsed() {
+	start=$(date +%s%N)
+	"$@" > /dev/null 2>&1
+	end=$(date +%s%N)
+	echo "$(( (end - start) / 1000000 )) ms"
+}
+
+echo "1 + 2" > /tmp/kal_startup.kal
+echo "== startup (1 + 2)"
+echo "vm:      $(elapsed ./kaleidoscope /tmp/kal_startup.kal)"
+echo "jit -O0: $(elapsed $JIT -q -O0 /tmp/kal_startup.kal)"
+echo "jit -O2: $(elapsed $JIT -q -O2 /tmp/kal_startup.kal)"
+rm -f /tmp/kal_startup.kal
+
+echo "== fib.kal vm"
+./kaleidoscope -time $FIB 2>&1
+for level in 0 2; do
+	echo "== fib.kal jit -O$level"
+	$JIT -q -time -O$level $FIB 2>&1 | grep -v '^$'
+done
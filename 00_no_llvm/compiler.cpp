@@ -0,0 +1,352 @@
+#include "compiler.hpp"
+
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <set>
+#include "ast.hpp"
+
+/// Natives made callable by 'extern'
+static std::set<std::string> DeclaredNatives;
+
+bool declareExtern(const std::string& name, unsigned arity) {
+	int native = TheVM.findNative(name);
+	if (native >= 0 && TheVM.findFunction(name) < 0) {
+		if (TheVM.native(native).arity != arity) {
+			std::cerr << "Function '" << name << "' takes " << TheVM.native(native).arity << " arguments" << std::endl;
+			return false;
+		}
+		DeclaredNatives.insert(name);
+		return true;
+	}
+	int found = TheVM.findFunction(name);
+	if (found >= 0 && TheVM.function(found).arity != arity) {
+		std::cerr << "Function '" << name << "' takes " << TheVM.function(found).arity << " arguments" << std::endl;
+		return false;
+	}
+	TheVM.declareFunction(name, arity);
+	return true;
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// Register allocation and emitting
+// ====----====----====----====----====----====----====----====----====----====
+FunctionCompiler::FunctionCompiler(const std::string& name, const std::vector<std::string>& args)
+	: m_name(name), m_arity(args.size()), m_next(args.size()), m_max(args.size()),
+	  m_isVariable(args.size(), true), m_lastLabel(0), m_failed(false)
+{
+	for (unsigned i = 0; i < m_arity; ++i) m_variables[args[i]].push_back(i);
+}
+
+unsigned FunctionCompiler::constant(double value) {
+	uint64_t bits;
+	std::memcpy(&bits, &value, sizeof(bits));
+	auto found = m_constantIndex.find(bits);
+	if (found != m_constantIndex.end()) return found->second;
+	if (m_constants.size() == ConstantTag) return fail("Too many constants in '" + m_name + "'");
+	unsigned reg = ConstantTag | m_constants.size();
+	m_constants.push_back(value);
+	m_constantIndex[bits] = reg;
+	return reg;
+}
+
+unsigned FunctionCompiler::newRegister() {
+	if (m_next == ConstantTag) return fail("Too many registers in '" + m_name + "'");
+	unsigned reg = m_next++;
+	if (m_isVariable.size() < m_next) m_isVariable.resize(m_next);
+	m_isVariable[reg] = false;
+	if (m_max < m_next) m_max = m_next;
+	return reg;
+}
+
+unsigned FunctionCompiler::newVariable(const std::string& name) {
+	unsigned reg = newRegister();
+	if (reg < m_isVariable.size()) m_isVariable[reg] = true;
+	m_variables[name].push_back(reg);
+	return reg;
+}
+
+void FunctionCompiler::endVariable(const std::string& name) {
+	auto found = m_variables.find(name);
+	found->second.pop_back();
+	if (found->second.empty()) m_variables.erase(found);
+}
+
+int FunctionCompiler::findVariable(const std::string& name) const {
+	auto found = m_variables.find(name);
+	return found == m_variables.end() ? -1 : (int)found->second.back();
+}
+
+bool FunctionCompiler::isVariable(unsigned reg) const {
+	return reg < m_isVariable.size() && m_isVariable[reg];
+}
+
+void FunctionCompiler::release(unsigned mark) {
+	m_next = mark;
+}
+
+unsigned FunctionCompiler::keep(unsigned reg, unsigned mark) {
+	release(mark);
+	if (reg & ConstantTag || reg < mark) return reg;
+	unsigned dest = newRegister();
+	emitMove(dest, reg);
+	return dest;
+}
+
+void FunctionCompiler::emit(Opcode op, unsigned a, unsigned b, unsigned c) {
+	m_code.push_back(Instr{op, (uint16_t)a, (uint16_t)b, (uint16_t)c});
+}
+
+void FunctionCompiler::emitMove(unsigned dest, unsigned value) {
+	if (dest == value) return;
+	if (! (value & ConstantTag) && value >= m_arity && ! isVariable(value)
+			&& ! m_code.empty() && m_lastLabel != here()) {
+		Instr& last = m_code.back();
+		switch (last.op) {
+		case OpMove: case OpAdd: case OpSub: case OpMul: case OpLess: case OpGreater:
+		case OpCall: case OpCallNative:
+			if (last.a == value) {
+				last.a = dest;
+				return;
+			}
+		}
+	}
+	emit(OpMove, dest, value);
+}
+
+size_t FunctionCompiler::emitJump(Opcode op, unsigned a) {
+	emit(op, a);
+	return m_code.size() - 1;
+}
+
+void FunctionCompiler::patchJump(size_t jump, size_t target) {
+	m_code[jump].setOffset((int32_t)(target - jump));
+	if (m_lastLabel < target) m_lastLabel = target;
+}
+
+unsigned FunctionCompiler::fail(const std::string& message) {
+	if (! m_failed) std::cerr << message << std::endl;
+	m_failed = true;
+	return 0;
+}
+
+unsigned FunctionCompiler::finalRegister(unsigned reg) const {
+	if (reg & ConstantTag) return m_arity + (reg & ~ConstantTag);
+	if (reg < m_arity) return reg;
+	return reg + m_constants.size();
+}
+
+bool FunctionCompiler::compile(const ExprAST& body, VMFunction& function) {
+	emit(OpReturn, body.compile(*this, true));
+	if (m_failed) return false;
+	if (m_max + m_constants.size() > MaxRegisters) {
+		fail("Too many registers in '" + m_name + "'");
+		return false;
+	}
+
+	// The constants go right after the arguments
+	for (Instr& ins : m_code) {
+		switch (ins.op) {
+		case OpJump:
+			break;
+		case OpJumpIfFalse:
+		case OpReturn:
+			ins.a = finalRegister(ins.a);
+			break;
+		case OpCall:
+		case OpCallNative:
+			ins.a = finalRegister(ins.a);
+			ins.c = finalRegister(ins.c);
+			break;
+		default:
+			ins.a = finalRegister(ins.a);
+			ins.b = finalRegister(ins.b);
+			ins.c = finalRegister(ins.c);
+		}
+	}
+	function.name = m_name;
+	function.arity = m_arity;
+	function.numRegisters = m_max + m_constants.size();
+	function.constants = std::move(m_constants);
+	function.code = std::move(m_code);
+	return true;
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// Bytecode of the syntax tree
+// ====----====----====----====----====----====----====----====----====----====
+unsigned NumberExprAST::compile(FunctionCompiler& fc, bool) const {
+	return fc.constant(m_val);
+}
+
+unsigned VariableExprAST::compile(FunctionCompiler& fc, bool) const {
+	int reg = fc.findVariable(m_name);
+	if (reg < 0) return fc.fail("Unknown variable: '" + m_name + "'");
+	return reg;
+}
+
+/// Values of leaves can't change while the other operand is computed.
+static bool isLeaf(const ExprAST* expr) {
+	return dynamic_cast<const NumberExprAST*>(expr) || dynamic_cast<const VariableExprAST*>(expr);
+}
+
+unsigned BinaryExprAST::compile(FunctionCompiler& fc, bool tail) const {
+	if (m_op == '=') {
+		const VariableExprAST* var = dynamic_cast<const VariableExprAST*>(m_left);
+		int reg = fc.findVariable(var->name());
+		if (reg < 0) return fc.fail("Unknown variable: '" + var->name() + "'");
+		unsigned mark = fc.mark();
+		unsigned value = m_right->compile(fc, false);
+		fc.release(mark);
+		fc.emitMove(reg, value);
+		return reg;
+	}
+
+	unsigned mark = fc.mark();
+	if (m_op == ':') {
+		m_left->compile(fc, false);
+		fc.release(mark);
+		return m_right->compile(fc, tail);
+	}
+
+	unsigned left = m_left->compile(fc, false);
+	// The right operand may assign the variable the left one read
+	if (fc.isVariable(left) && ! isLeaf(m_right)) {
+		unsigned copy = fc.newRegister();
+		fc.emit(OpMove, copy, left);
+		left = copy;
+	}
+	unsigned right = m_right->compile(fc, false);
+	fc.release(mark);
+	unsigned dest = fc.newRegister();
+	switch (m_op) {
+	case '+': fc.emit(OpAdd, dest, left, right); break;
+	case '-': fc.emit(OpSub, dest, left, right); break;
+	case '*': fc.emit(OpMul, dest, left, right); break;
+	case '<': fc.emit(OpLess, dest, left, right); break;
+	case '>': fc.emit(OpGreater, dest, left, right); break;
+	default: return fc.fail(std::string("Unknown operator: '") + m_op + "'");
+	}
+	return dest;
+}
+
+unsigned CallExprAST::compile(FunctionCompiler& fc, bool tail) const {
+	int function = TheVM.findFunction(m_name);
+	int native = -1;
+	unsigned arity = 0;
+	if (function >= 0) arity = TheVM.function(function).arity;
+	else if (m_name == fc.name()) arity = fc.arity();
+	else if (DeclaredNatives.count(m_name)) {
+		native = TheVM.findNative(m_name);
+		arity = TheVM.native(native).arity;
+	} else return fc.fail("Failed finding function: '" + m_name + "'");
+	if (m_exps.size() != arity)
+		return fc.fail("Function '" + m_name + "' expects " + std::to_string(arity) + " arguments, "
+			+ std::to_string(m_exps.size()) + " given");
+
+	// The arguments go to consecutive registers, which become the first
+	// registers of the callee
+	unsigned mark = fc.mark();
+	unsigned base = mark;
+	for (unsigned i = 0; i < m_exps.size(); ++i) fc.newRegister();
+	for (unsigned i = 0; i < m_exps.size(); ++i) {
+		unsigned argMark = fc.mark();
+		unsigned value = m_exps[i]->compile(fc, false);
+		fc.release(argMark);
+		fc.emitMove(base + i, value);
+	}
+
+	// A self call in tail position becomes a jump to the start
+	if (tail && m_name == fc.name() && native < 0) {
+		for (unsigned i = 0; i < arity; ++i) fc.emit(OpMove, i, base + i);
+		fc.patchJump(fc.emitJump(OpJump), 0);
+		fc.release(mark);
+		return fc.newRegister();
+	}
+
+	fc.release(mark);
+	unsigned dest = fc.newRegister();
+	if (native >= 0) fc.emit(OpCallNative, dest, native, base);
+	else {
+		if (function < 0) function = TheVM.declareFunction(m_name, arity);
+		fc.emit(OpCall, dest, function, base);
+	}
+	return dest;
+}
+
+unsigned IfThenElseExprAST::compile(FunctionCompiler& fc, bool tail) const {
+	unsigned mark = fc.mark();
+	unsigned cond = m_cond->compile(fc, false);
+	size_t toElse = fc.emitJump(OpJumpIfFalse, cond);
+	fc.release(mark);
+	unsigned dest = fc.newRegister();
+	unsigned branchMark = fc.mark();
+
+	unsigned value = m_thenExpr->compile(fc, tail);
+	fc.emitMove(dest, value);
+	fc.release(branchMark);
+	size_t toEnd = fc.emitJump(OpJump);
+
+	fc.patchJump(toElse, fc.here());
+	value = m_elseExpr->compile(fc, tail);
+	fc.emitMove(dest, value);
+	fc.release(branchMark);
+
+	fc.patchJump(toEnd, fc.here());
+	return dest;
+}
+
+unsigned ForExprAST::compile(FunctionCompiler& fc, bool) const {
+	unsigned mark = fc.mark();
+	unsigned init = m_init->compile(fc, false);
+	fc.release(mark);
+	unsigned var = fc.newVariable(m_varName);
+	fc.emitMove(var, init);
+	unsigned bodyMark = fc.mark();
+
+	// The whole condition is evaluated again on every iteration
+	size_t loop = fc.here();
+	unsigned cond = m_cond->compile(fc, false);
+	size_t toEnd = fc.emitJump(OpJumpIfFalse, cond);
+	fc.release(bodyMark);
+	m_body->compile(fc, false);
+	fc.release(bodyMark);
+	unsigned step = m_step ? m_step->compile(fc, false) : fc.constant(1.0);
+	fc.emit(OpAdd, var, var, step);
+	fc.release(bodyMark);
+	fc.patchJump(fc.emitJump(OpJump), loop);
+	fc.patchJump(toEnd, fc.here());
+
+	fc.endVariable(m_varName);
+	fc.release(mark);
+	return fc.constant(0.0);
+}
+
+unsigned WhileExprAST::compile(FunctionCompiler& fc, bool) const {
+	unsigned mark = fc.mark();
+	size_t loop = fc.here();
+	unsigned cond = m_cond->compile(fc, false);
+	size_t toEnd = fc.emitJump(OpJumpIfFalse, cond);
+	fc.release(mark);
+	m_body->compile(fc, false);
+	fc.release(mark);
+	fc.patchJump(fc.emitJump(OpJump), loop);
+	fc.patchJump(toEnd, fc.here());
+	return fc.constant(0.0);
+}
+
+unsigned VarDefExprAST::compile(FunctionCompiler& fc, bool tail) const {
+	unsigned mark = fc.mark();
+	for (auto& def : m_varDeclDefs) {
+		// The initial value still sees an older variable of the same name
+		unsigned initMark = fc.mark();
+		unsigned value = def.second ? def.second->compile(fc, false) : fc.constant(0.0);
+		fc.release(initMark);
+		unsigned var = fc.newVariable(def.first);
+		fc.emitMove(var, value);
+	}
+	unsigned result = m_innerExpr->compile(fc, tail);
+	for (auto def = m_varDeclDefs.rbegin(); def != m_varDeclDefs.rend(); ++def)
+		fc.endVariable(def->first);
+	return fc.keep(result, mark);
+}
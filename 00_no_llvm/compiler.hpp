@@ -0,0 +1,90 @@
+#ifndef COMPILER_HPP
+#define COMPILER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include "vm.hpp"
+
+class ExprAST;
+
+/// Compiles the body of one function into bytecode for TheVM.
+///
+/// While compiling, registers are numbered as if the constants came last:
+/// arguments, then variables and temporaries (allocated like a stack, see
+/// mark() and release()), constants are tagged with ConstantTag. Once the
+/// number of constants is known they move in front of the variables.
+class FunctionCompiler {
+public:
+	FunctionCompiler(const std::string& name, const std::vector<std::string>& args);
+
+	/// Compiles 'body' into 'function'.
+	/// Returns false on errors (already reported).
+	bool compile(const ExprAST& body, VMFunction& function);
+
+	const std::string& name() const { return m_name; }
+	unsigned arity() const { return m_arity; }
+
+	/// Returns the register of a constant.
+	unsigned constant(double value);
+	/// Returns a new temporary register.
+	unsigned newRegister();
+	/// Returns a new register for variable 'name', which hides any older
+	/// one until endVariable().
+	unsigned newVariable(const std::string& name);
+	void endVariable(const std::string& name);
+	/// Returns the register of variable 'name' or -1 if there is none.
+	int findVariable(const std::string& name) const;
+	/// Variables can change while a value is still needed, temporaries
+	/// and constants can't.
+	bool isVariable(unsigned reg) const;
+
+	/// Registers allocated after mark() are free again after release().
+	unsigned mark() const { return m_next; }
+	void release(unsigned mark);
+	/// Releases the registers after 'mark' but 'reg', which is moved to
+	/// the first free register if needed. Returns where it is.
+	unsigned keep(unsigned reg, unsigned mark);
+
+	void emit(Opcode op, unsigned a, unsigned b = 0, unsigned c = 0);
+	/// Emits dest = value. If 'value' is a temporary the last instruction
+	/// just computed, that one writes to 'dest' instead.
+	void emitMove(unsigned dest, unsigned value);
+	/// Emits a jump whose target is set by patchJump().
+	size_t emitJump(Opcode op, unsigned a = 0);
+	void patchJump(size_t jump, size_t target);
+	/// The index of the next instruction.
+	size_t here() const { return m_code.size(); }
+
+	/// Reports an error, returns a register to go on with.
+	unsigned fail(const std::string& message);
+
+private:
+	FunctionCompiler(const FunctionCompiler&) = delete;
+	FunctionCompiler& operator=(const FunctionCompiler&) = delete;
+
+	static const unsigned ConstantTag = 0x8000;
+	unsigned finalRegister(unsigned reg) const;
+
+	std::string m_name;
+	unsigned m_arity;
+	/// Next free register and the highest one used so far (+1)
+	unsigned m_next, m_max;
+	std::vector<bool> m_isVariable;
+	std::unordered_map<std::string, std::vector<unsigned> > m_variables;
+	std::vector<double> m_constants;
+	std::unordered_map<uint64_t, unsigned> m_constantIndex;
+	std::vector<Instr> m_code;
+	/// The highest jump target (a label stops emitMove() from changing the
+	/// instruction before it)
+	size_t m_lastLabel;
+	bool m_failed;
+};
+
+/// Makes 'name' callable, as a native if there is one.
+/// Returns false (after reporting) if its arity doesn't fit.
+bool declareExtern(const std::string& name, unsigned arity);
+
+#endif /* ifndef COMPILER_HPP */
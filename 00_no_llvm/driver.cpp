@@ -0,0 +1,82 @@
+#include "driver.hpp"
+
+#include <chrono>
+#include <cstring>
+#include <iostream>
+#include "ast.hpp"
+#include "compiler.hpp"
+#include "vm.hpp"
+
+Options TheOptions;
+
+static void printUsage(const char* prog) {
+	std::cerr << "Usage: " << prog << " [options] [file.kal]\n"
+		<< "  -show            print every command like it looks in source code\n"
+		<< "  -dump            print the bytecode of every function\n"
+		<< "  -time            report execution time of top-level expressions\n";
+}
+
+bool parseOptions(int argc, char* argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		const char* arg = argv[i];
+		if (std::strcmp(arg, "-show") == 0) TheOptions.show = true;
+		else if (std::strcmp(arg, "-dump") == 0) TheOptions.dump = true;
+		else if (std::strcmp(arg, "-time") == 0) TheOptions.time = true;
+		else if (arg[0] == '-') {
+			std::cerr << "Unknown option '" << arg << "'" << std::endl;
+			printUsage(argv[0]);
+			return false;
+		} else if (TheOptions.inputFile.empty()) TheOptions.inputFile = arg;
+		else {
+			printUsage(argv[0]);
+			return false;
+		}
+	}
+	return true;
+}
+
+/// Compiles 'body' into function 'name' of TheVM.
+/// Returns its index or -1 on errors (already reported).
+static int compileFunction(const PrototypeAST& proto, const ExprAST& body) {
+	int found = TheVM.findFunction(proto.name());
+	if (found >= 0 && TheVM.function(found).arity != proto.args().size()) {
+		std::cerr << "Function '" << proto.name() << "' takes "
+			<< TheVM.function(found).arity << " arguments" << std::endl;
+		return -1;
+	}
+
+	VMFunction function;
+	FunctionCompiler fc(proto.name(), proto.args());
+	if (! fc.compile(body, function)) return -1;
+	unsigned index = TheVM.declareFunction(proto.name(), proto.args().size());
+	if (TheOptions.dump) TheVM.disassemble(function, std::cerr);
+	TheVM.defineFunction(index, std::move(function));
+	return index;
+}
+
+void HandleDefinition(PrototypeAST* proto, ExprAST* body) {
+	FunctionAST fun(*proto, body);
+	delete proto;
+	if (TheOptions.show) std::cout << "def " << fun.src_show() << std::endl;
+	compileFunction(fun.proto(), fun.definition());
+}
+
+void HandleExtern(PrototypeAST* proto) {
+	if (TheOptions.show) std::cout << "extern " << proto->src_show() << std::endl;
+	declareExtern(proto->name(), proto->args().size());
+	delete proto;
+}
+
+void HandleTopLevelExpression(ExprAST* expr) {
+	FunctionAST fun(PrototypeAST("__anon_expr", std::vector<std::string>()), expr);
+	if (TheOptions.show) std::cout << expr->src_show() << std::endl;
+	int index = compileFunction(fun.proto(), fun.definition());
+	if (index < 0) return;
+
+	auto start = std::chrono::steady_clock::now();
+	double value;
+	if (! TheVM.run(index, value)) return;
+	std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+	std::cout << "Expression value: " << value << std::endl;
+	if (TheOptions.time) std::cerr << "; executed in " << took.count() << " ms" << std::endl;
+}
@@ -0,0 +1,43 @@
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+#include <string>
+
+class ExprAST;
+class PrototypeAST;
+
+/// Command line options.
+struct Options {
+	Options()
+		: show(false), dump(false), time(false)
+	{}
+
+	/// Print every command like it looks in source code (-show).
+	bool show;
+	/// Print the bytecode of every function (-dump).
+	bool dump;
+	/// Report how long every top-level expression took to run (-time).
+	bool time;
+	/// Read from this file instead of stdin.
+	std::string inputFile;
+};
+
+extern Options TheOptions;
+
+/// Parses the command line into TheOptions, returns false on errors.
+bool parseOptions(int argc, char* argv[]);
+
+/// What the parser does with every top-level command.
+/// The handlers take ownership of what they get.
+
+/// 'def': compiles the function to bytecode.
+void HandleDefinition(PrototypeAST* proto, ExprAST* body);
+
+/// 'extern': declares the function (natives like sin or printd are
+/// only callable after it).
+void HandleExtern(PrototypeAST* proto);
+
+/// A top-level expression: compiles it into __anon_expr and runs it.
+void HandleTopLevelExpression(ExprAST* expr);
+
+#endif /* ifndef DRIVER_HPP */
@@ -0,0 +1,242 @@
+#include "vm.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+// GCC and clang jump straight from one instruction to the next through a
+// table of label addresses, anything else goes back to a switch
+#if defined(__GNUC__)
+#define VM_COMPUTED_GOTO 1
+#endif
+
+VM TheVM;
+
+/// Registers of all running functions (8 MB)
+static const size_t StackSize = 1 << 20;
+/// Nested calls
+static const size_t MaxFrames = 1 << 18;
+
+static double printd(double x) {
+	std::cout << x << std::endl;
+	return 0;
+}
+
+static double putchard(double x) {
+	putchar((int)x);
+	return 0;
+}
+
+typedef double (*UnaryFunction)(double);
+typedef double (*BinaryFunction)(double, double);
+
+VM::VM()
+	: m_stack(new double[StackSize]), m_stackEnd(m_stack.get() + StackSize)
+{
+	m_frames.reserve(64);
+	addNative("printd", printd);
+	addNative("putchard", putchard);
+	addNative("sin", (UnaryFunction)std::sin);
+	addNative("cos", (UnaryFunction)std::cos);
+	addNative("tan", (UnaryFunction)std::tan);
+	addNative("atan", (UnaryFunction)std::atan);
+	addNative("exp", (UnaryFunction)std::exp);
+	addNative("log", (UnaryFunction)std::log);
+	addNative("sqrt", (UnaryFunction)std::sqrt);
+	addNative("fabs", (UnaryFunction)std::fabs);
+	addNative("floor", (UnaryFunction)std::floor);
+	addNative("ceil", (UnaryFunction)std::ceil);
+	addNative("pow", (BinaryFunction)std::pow);
+	addNative("atan2", (BinaryFunction)std::atan2);
+	addNative("fmod", (BinaryFunction)std::fmod);
+}
+
+void VM::addNative(const std::string& name, unsigned arity, void (*address)()) {
+	m_nativeIndex[name] = m_natives.size();
+	m_natives.push_back(Native{name, arity, address});
+}
+
+int VM::findFunction(const std::string& name) const {
+	auto found = m_functionIndex.find(name);
+	return found == m_functionIndex.end() ? -1 : (int)found->second;
+}
+
+unsigned VM::declareFunction(const std::string& name, unsigned arity) {
+	int found = findFunction(name);
+	if (found >= 0) return found;
+	VMFunction function;
+	function.name = name;
+	function.arity = arity;
+	m_functionIndex[name] = m_functions.size();
+	m_functions.push_back(std::move(function));
+	return m_functions.size() - 1;
+}
+
+void VM::defineFunction(unsigned index, VMFunction function) {
+	function.defined = true;
+	m_functions[index] = std::move(function);
+}
+
+int VM::findNative(const std::string& name) const {
+	auto found = m_nativeIndex.find(name);
+	return found == m_nativeIndex.end() ? -1 : (int)found->second;
+}
+
+double VM::callNative(const Native& native, const double* args) {
+	switch (native.arity) {
+	case 0: return ((double (*)())native.address)();
+	case 1: return ((double (*)(double))native.address)(args[0]);
+	case 2: return ((double (*)(double, double))native.address)(args[0], args[1]);
+	case 3: return ((double (*)(double, double, double))native.address)(args[0], args[1], args[2]);
+	}
+	return 0;
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// Dispatch loop
+// ====----====----====----====----====----====----====----====----====----====
+#ifdef VM_COMPUTED_GOTO
+#define VM_CASE(op) L_##op:
+#define VM_NEXT() goto *Labels[(ins = pc++)->op]
+#else
+#define VM_CASE(op) case op:
+#define VM_NEXT() goto dispatch
+#endif
+
+bool VM::run(unsigned index, double& result) {
+	const VMFunction& entry = m_functions[index];
+	if (! entry.defined) {
+		std::cerr << "Function '" << entry.name << "' is declared but not defined" << std::endl;
+		return false;
+	}
+	if (entry.numRegisters > StackSize) {
+		std::cerr << "Stack overflow" << std::endl;
+		return false;
+	}
+	m_frames.clear();
+	double* r = m_stack.get();
+	std::copy(entry.constants.begin(), entry.constants.end(), r + entry.arity);
+	const Instr* pc = entry.code.data();
+	const Instr* ins;
+
+#ifdef VM_COMPUTED_GOTO
+	// In the order of Opcode
+	static const void* const Labels[NumOpcodes] = {
+		&&L_OpMove, &&L_OpAdd, &&L_OpSub, &&L_OpMul, &&L_OpLess, &&L_OpGreater,
+		&&L_OpJump, &&L_OpJumpIfFalse, &&L_OpCall, &&L_OpCallNative, &&L_OpReturn,
+	};
+	VM_NEXT();
+#else
+dispatch:
+	ins = pc++;
+	switch (ins->op) {
+#endif
+
+	VM_CASE(OpMove)
+		r[ins->a] = r[ins->b];
+		VM_NEXT();
+	VM_CASE(OpAdd)
+		r[ins->a] = r[ins->b] + r[ins->c];
+		VM_NEXT();
+	VM_CASE(OpSub)
+		r[ins->a] = r[ins->b] - r[ins->c];
+		VM_NEXT();
+	VM_CASE(OpMul)
+		r[ins->a] = r[ins->b] * r[ins->c];
+		VM_NEXT();
+	VM_CASE(OpLess)
+		r[ins->a] = ! (r[ins->b] >= r[ins->c]);
+		VM_NEXT();
+	VM_CASE(OpGreater)
+		r[ins->a] = ! (r[ins->b] <= r[ins->c]);
+		VM_NEXT();
+	VM_CASE(OpJump)
+		pc = ins + ins->offset();
+		VM_NEXT();
+	VM_CASE(OpJumpIfFalse)
+		// 0 and NaN are false, like the JIT's 'one' comparison
+		if (! (r[ins->a] < 0 || r[ins->a] > 0)) pc = ins + ins->offset();
+		VM_NEXT();
+	VM_CASE(OpCall) {
+		const VMFunction& callee = m_functions[ins->b];
+		if (! callee.defined) {
+			std::cerr << "Function '" << callee.name << "' is declared but not defined" << std::endl;
+			return false;
+		}
+		double* calleeRegisters = r + ins->c;
+		if (m_stackEnd - calleeRegisters < (ptrdiff_t)callee.numRegisters || m_frames.size() == MaxFrames) {
+			std::cerr << "Stack overflow in '" << callee.name << "'" << std::endl;
+			return false;
+		}
+		m_frames.push_back(Frame{pc, r, ins->a});
+		r = calleeRegisters;
+		std::copy(callee.constants.begin(), callee.constants.end(), r + callee.arity);
+		pc = callee.code.data();
+		VM_NEXT();
+	}
+	VM_CASE(OpCallNative)
+		r[ins->a] = callNative(m_natives[ins->b], r + ins->c);
+		VM_NEXT();
+	VM_CASE(OpReturn) {
+		double value = r[ins->a];
+		if (m_frames.empty()) {
+			result = value;
+			return true;
+		}
+		const Frame& frame = m_frames.back();
+		pc = frame.pc;
+		r = frame.registers;
+		r[frame.dest] = value;
+		m_frames.pop_back();
+		VM_NEXT();
+	}
+
+#ifndef VM_COMPUTED_GOTO
+	}
+	return false;
+#endif
+}
+
+#undef VM_CASE
+#undef VM_NEXT
+
+// ====----====----====----====----====----====----====----====----====----====
+// Disassembly
+// ====----====----====----====----====----====----====----====----====----====
+void VM::disassemble(const VMFunction& function, std::ostream& os) const {
+	static const char* const Names[NumOpcodes] = {
+		"move", "add", "sub", "mul", "less", "greater",
+		"jump", "jumpiffalse", "call", "callnative", "return",
+	};
+	os << "; " << function.name << ": " << function.arity << " arguments, "
+		<< function.numRegisters << " registers, constants";
+	for (double constant : function.constants) os << " " << constant;
+	os << std::endl;
+	for (size_t i = 0; i < function.code.size(); ++i) {
+		const Instr& ins = function.code[i];
+		os << "  " << i << "\t" << Names[ins.op] << "\t";
+		switch (ins.op) {
+		case OpMove:
+			os << "r" << ins.a << ", r" << ins.b;
+			break;
+		case OpJump:
+			os << i + ins.offset();
+			break;
+		case OpJumpIfFalse:
+			os << "r" << ins.a << ", " << i + ins.offset();
+			break;
+		case OpCall:
+			os << "r" << ins.a << ", " << m_functions[ins.b].name << ", r" << ins.c;
+			break;
+		case OpCallNative:
+			os << "r" << ins.a << ", " << m_natives[ins.b].name << ", r" << ins.c;
+			break;
+		case OpReturn:
+			os << "r" << ins.a;
+			break;
+		default:
+			os << "r" << ins.a << ", r" << ins.b << ", r" << ins.c;
+		}
+		os << std::endl;
+	}
+}
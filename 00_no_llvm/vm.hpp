@@ -0,0 +1,125 @@
+#ifndef VM_HPP
+#define VM_HPP
+
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+/// A register machine running Kaleidoscope without LLVM.
+///
+/// Every function is compiled into a flat array of instructions working on
+/// a window of registers of its own: its arguments come first, then its
+/// constants (copied in on every call), then its variables and temporaries.
+/// A call takes its arguments from consecutive registers of the caller, which
+/// become the first registers of the callee, so nothing is copied.
+
+enum Opcode : uint16_t {
+	OpMove,        // a = b
+	OpAdd,         // a = b + c
+	OpSub,         // a = b - c
+	OpMul,         // a = b * c
+	OpLess,        // a = b < c (true for NaN, like the JIT)
+	OpGreater,     // a = b > c (true for NaN, like the JIT)
+	OpJump,        // goto offset
+	OpJumpIfFalse, // goto offset if a is 0 or NaN
+	OpCall,        // a = function b, arguments from register c
+	OpCallNative,  // a = native b, arguments from register c
+	OpReturn,      // return a
+	NumOpcodes
+};
+
+/// Registers are 16 bits. Jumps take b and c for the offset of their
+/// target from the jump itself.
+struct Instr {
+	uint16_t op, a, b, c;
+
+	int32_t offset() const { return (int32_t)((uint32_t)b << 16 | c); }
+	void setOffset(int32_t offset) {
+		b = (uint32_t)offset >> 16;
+		c = (uint32_t)offset & 0xffff;
+	}
+};
+
+/// Upper bound of the registers of a function (arguments, constants,
+/// variables and temporaries).
+const unsigned MaxRegisters = 0x10000;
+
+struct VMFunction {
+	std::string name;
+	unsigned arity = 0;
+	/// Declared by 'extern' (or called before its 'def') but not defined yet
+	bool defined = false;
+	unsigned numRegisters = 0;
+	/// Copied into the registers after the arguments on every call
+	std::vector<double> constants;
+	std::vector<Instr> code;
+};
+
+/// A host function callable with 'extern' (sin, printd...).
+struct Native {
+	std::string name;
+	unsigned arity;
+	void (*address)();
+};
+
+/// Upper bound of the arguments of natives.
+const unsigned MaxNativeArgs = 3;
+
+class VM {
+public:
+	VM();
+
+	/// Returns the index of function 'name' or -1 if there is none.
+	int findFunction(const std::string& name) const;
+	/// Returns the index of function 'name', adding it undefined if needed.
+	unsigned declareFunction(const std::string& name, unsigned arity);
+	/// Replaces the code of a function, callers run the new one from now on.
+	void defineFunction(unsigned index, VMFunction function);
+	const VMFunction& function(unsigned index) const { return m_functions[index]; }
+
+	/// Returns the index of native 'name' or -1 if there is none.
+	int findNative(const std::string& name) const;
+	const Native& native(unsigned index) const { return m_natives[index]; }
+
+	/// Runs function 'index' (which takes no arguments). Returns false
+	/// on errors (calling an undefined function, running out of stack).
+	bool run(unsigned index, double& result);
+
+	/// Prints the instructions of a function.
+	void disassemble(const VMFunction& function, std::ostream& os) const;
+
+private:
+	VM(const VM&) = delete;
+	VM& operator=(const VM&) = delete;
+
+	void addNative(const std::string& name, unsigned arity, void (*address)());
+	template <typename... Args>
+	void addNative(const std::string& name, double (*address)(Args...)) {
+		addNative(name, sizeof...(Args), (void (*)())address);
+	}
+	static double callNative(const Native& native, const double* args);
+
+	std::vector<VMFunction> m_functions;
+	std::unordered_map<std::string, unsigned> m_functionIndex;
+	std::vector<Native> m_natives;
+	std::unordered_map<std::string, unsigned> m_nativeIndex;
+
+	/// Where to go back to when a function returns
+	struct Frame {
+		const Instr* pc;
+		double* registers;
+		uint16_t dest;
+	};
+	std::vector<Frame> m_frames;
+	/// Register windows of all running functions (not initialized, so
+	/// untouched pages cost nothing at startup)
+	std::unique_ptr<double[]> m_stack;
+	double* m_stackEnd;
+};
+
+extern VM TheVM;
+
+#endif /* ifndef VM_HPP */
@@ -18,59 +18,227 @@
 #include "llvm/ExecutionEngine/RTDyldMemoryManager.h"
 #include "llvm/ExecutionEngine/Orc/CompileUtils.h"
 #include "llvm/ExecutionEngine/Orc/IRCompileLayer.h"
+#include "llvm/ExecutionEngine/Orc/IndirectionUtils.h"
 #include "llvm/ExecutionEngine/Orc/LambdaResolver.h"
 #include "llvm/ExecutionEngine/Orc/ObjectLinkingLayer.h"
 #include "llvm/IR/Mangler.h"
 #include "llvm/Support/DynamicLibrary.h"
+#include "llvm/Support/Host.h"
+#include "llvm/Support/RWMutex.h"
+#include <algorithm>
+#include <atomic>
+#include <functional>
+#include <mutex>
+#include <unordered_map>
 
 namespace llvm {
 namespace orc {
 
+/// A SectionMemoryManager counting the bytes of the sections it allocates
+/// in Allocated, until it is destroyed with its module.
+class CountingMemoryManager : public SectionMemoryManager {
+public:
+  explicit CountingMemoryManager(std::atomic<uint64_t> &Allocated)
+      : Allocated(Allocated), Size(0) {}
+
+  ~CountingMemoryManager() override { Allocated -= Size; }
+
+  uint8_t *allocateCodeSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID,
+                               StringRef SectionName) override {
+    count(Size);
+    return SectionMemoryManager::allocateCodeSection(Size, Alignment,
+                                                     SectionID, SectionName);
+  }
+
+  uint8_t *allocateDataSection(uintptr_t Size, unsigned Alignment,
+                               unsigned SectionID, StringRef SectionName,
+                               bool IsReadOnly) override {
+    count(Size);
+    return SectionMemoryManager::allocateDataSection(
+        Size, Alignment, SectionID, SectionName, IsReadOnly);
+  }
+
+private:
+  void count(uintptr_t Bytes) {
+    Size += Bytes;
+    Allocated += Bytes;
+  }
+
+  std::atomic<uint64_t> &Allocated;
+  uint64_t Size;
+};
+
 class KaleidoscopeJIT {
 public:
   typedef ObjectLinkingLayer<> ObjLayerT;
   typedef IRCompileLayer<ObjLayerT> CompileLayerT;
   typedef CompileLayerT::ModuleSetHandleT ModuleHandleT;
 
-  KaleidoscopeJIT()
-      : TM(EngineBuilder().selectTarget()), DL(TM->createDataLayout()),
-        CompileLayer(ObjectLayer, SimpleCompiler(*TM)) {
+  /// With PIC the target machine emits position independent code, so what
+  /// it compiles can go into a shared library too (see aot.hpp).
+  /// Code is generated for the host CPU and its features unless CPU names
+  /// another one; Features ("+avx2", "-fma", ...) are applied on top.
+  explicit KaleidoscopeJIT(bool PIC = false, const std::string &CPU = "",
+                           const std::vector<std::string> &Features = {})
+      : TM(createTargetMachine(PIC, CPU, Features)),
+        DL(TM->createDataLayout()), AllocatedBytes(0),
+        CompileLayer(ObjectLayer, SimpleCompiler(*TM)),
+        IndirectStubsMgr(
+            createLocalIndirectStubsManagerBuilder(TM->getTargetTriple())()),
+        CompileCallbackMgr(
+            createLocalCompileCallbackManager(TM->getTargetTriple(), 0)) {
     llvm::sys::DynamicLibrary::LoadLibraryPermanently(nullptr);
   }
 
   TargetMachine &getTargetMachine() { return *TM; }
 
+  /// Objects of new modules are looked up in (and written to) Cache.
+  void setObjectCache(ObjectCache *Cache) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    CompileLayer.setObjectCache(Cache);
+  }
+
   ModuleHandleT addModule(std::unique_ptr<Module> M) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
     // We need a memory manager to allocate memory and resolve symbols for this
     // new module. Create one that resolves symbols by looking back into the
     // JIT.
     auto Resolver = createLambdaResolver(
         [&](const std::string &Name) {
+          std::lock_guard<std::recursive_mutex> Lock(JITMutex);
           if (auto Sym = findMangledSymbol(Name))
             return RuntimeDyld::SymbolInfo(Sym.getAddress(), Sym.getFlags());
           return RuntimeDyld::SymbolInfo(nullptr);
         },
         [](const std::string &S) { return nullptr; });
+    std::vector<std::string> Names = definedSymbols(*M);
     auto H = CompileLayer.addModuleSet(singletonSet(std::move(M)),
-                                       make_unique<SectionMemoryManager>(),
+                                       make_unique<CountingMemoryManager>(
+                                           AllocatedBytes),
                                        std::move(Resolver));
 
-    ModuleHandles.push_back(H);
+    sys::SmartScopedWriter<true> Writer(IndexLock);
+    for (auto &Name : Names)
+      SymbolIndex[Name].push_back(IndexEntry{H, 0});
+    ModuleSymbols.push_back(std::make_pair(H, std::move(Names)));
     return H;
   }
 
   void removeModule(ModuleHandleT H) {
-    ModuleHandles.erase(
-        std::find(ModuleHandles.begin(), ModuleHandles.end(), H));
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    {
+      sys::SmartScopedWriter<true> Writer(IndexLock);
+      // The module added last is usually the one going away
+      auto It = std::find_if(ModuleSymbols.rbegin(), ModuleSymbols.rend(),
+                             [&](const std::pair<ModuleHandleT,
+                                                 std::vector<std::string>> &MS) {
+                               return MS.first == H;
+                             });
+      for (auto &Name : It->second) {
+        auto &Entries = SymbolIndex[Name];
+        Entries.erase(std::find_if(
+            Entries.begin(), Entries.end(),
+            [&](const IndexEntry &E) { return E.Handle == H; }));
+        if (Entries.empty())
+          SymbolIndex.erase(Name);
+      }
+      ModuleSymbols.erase(std::next(It).base());
+    }
     CompileLayer.removeModuleSet(H);
   }
 
+  /// Bytes of code and data sections of the modules in the JIT.
+  uint64_t getAllocatedBytes() const { return AllocatedBytes; }
+
+  size_t getNumModules() {
+    sys::SmartScopedReader<true> Reader(IndexLock);
+    return ModuleSymbols.size();
+  }
+
   JITSymbol findSymbol(const std::string Name) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
     return findMangledSymbol(mangle(Name));
   }
 
+  // The address getters below link the module the symbol lives in while
+  // holding the lock, so they are safe to use from several threads.
+  // Addresses found before are read from the index without the lock.
+  TargetAddress getSymbolAddress(const std::string Name) {
+    std::string MangledName = mangle(Name);
+    if (auto Addr = findCachedAddress(MangledName))
+      return Addr;
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    return findMangledSymbol(MangledName).getAddress();
+  }
+
+  TargetAddress getSymbolAddressIn(ModuleHandleT H, const std::string Name) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    return CompileLayer.findSymbolIn(H, mangle(Name), false).getAddress();
+  }
+
+  // Indirection stubs: a stub is a symbol that jumps through a pointer we
+  // can change later. Stubs are found before any module symbol.
+  bool hasStub(const std::string &Name) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    return static_cast<bool>(IndirectStubsMgr->findStub(mangle(Name), false));
+  }
+
+  /// Returns the address of a new compile callback. The first jump to it runs
+  /// Compile, which returns the address of the code to continue in.
+  TargetAddress createCompileCallback(std::function<TargetAddress()> Compile) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    auto CCInfo = CompileCallbackMgr->getCompileCallback();
+    CCInfo.setCompileAction(std::move(Compile));
+    return CCInfo.getAddress();
+  }
+
+  /// Creates the stub Name jumping to Addr, or points an existing one to Addr.
+  void createStub(const std::string &Name, TargetAddress Addr) {
+    std::lock_guard<std::recursive_mutex> Lock(JITMutex);
+    std::string MangledName = mangle(Name);
+    Error Err = IndirectStubsMgr->findStub(MangledName, false)
+                    ? IndirectStubsMgr->updatePointer(MangledName, Addr)
+                    : IndirectStubsMgr->createStub(MangledName, Addr,
+                                                   JITSymbolFlags::Exported);
+    if (Err) {
+      logAllUnhandledErrors(std::move(Err), errs(),
+                            "Failed setting stub '" + Name + "': ");
+      return;
+    }
+    // Updating the pointer doesn't move the stub
+    sys::SmartScopedWriter<true> Writer(IndexLock);
+    StubIndex[MangledName] =
+        IndirectStubsMgr->findStub(MangledName, false).getAddress();
+  }
+
 private:
 
+  static TargetMachine *
+  createTargetMachine(bool PIC, const std::string &CPU,
+                      const std::vector<std::string> &Features) {
+    SmallVector<std::string, 32> MAttrs;
+    std::string MCPU = CPU;
+    if (MCPU.empty() || MCPU == "native") {
+      MCPU = sys::getHostCPUName();
+      // The CPU name alone misses features the OS can't save (like AVX
+      // without XSAVE), and those a newer CPU has over its known model.
+      StringMap<bool> HostFeatures;
+      if (sys::getHostCPUFeatures(HostFeatures))
+        for (auto &F : HostFeatures)
+          MAttrs.push_back((F.second ? "+" : "-") + F.first().str());
+      // Keep the feature string stable, it's part of the object cache key
+      std::sort(MAttrs.begin(), MAttrs.end());
+    }
+    MAttrs.append(Features.begin(), Features.end());
+
+    EngineBuilder Builder;
+    Builder.setMCPU(MCPU).setMAttrs(MAttrs);
+    if (PIC)
+      Builder.setRelocationModel(Reloc::PIC_);
+    return Builder.selectTarget();
+  }
+
   std::string mangle(const std::string &Name) {
     std::string MangledName;
     {
@@ -86,13 +254,69 @@ private:
     return Vec;
   }
 
+  /// Mangled names of the symbols M defines for other modules.
+  std::vector<std::string> definedSymbols(const Module &M) {
+    std::vector<std::string> Names;
+    auto Add = [&](const GlobalValue &GV) {
+      if (!GV.isDeclaration() && !GV.hasLocalLinkage() &&
+          !GV.hasAvailableExternallyLinkage())
+        Names.push_back(mangle(GV.getName()));
+    };
+    for (auto &F : M)
+      Add(F);
+    for (auto &GV : M.globals())
+      Add(GV);
+    for (auto &A : M.aliases())
+      Add(A);
+    return Names;
+  }
+
+  /// Returns the address of Name if it is a stub or was looked up before,
+  /// 0 otherwise. Takes the index lock only.
+  TargetAddress findCachedAddress(const std::string &Name) {
+    sys::SmartScopedReader<true> Reader(IndexLock);
+    auto Stub = StubIndex.find(Name);
+    if (Stub != StubIndex.end())
+      return Stub->second;
+    auto Found = SymbolIndex.find(Name);
+    if (Found == SymbolIndex.end())
+      return 0;
+    return Found->second.back().Address;
+  }
+
+  /// Callers hold JITMutex, so the index only changes under our feet when
+  /// the address of a module is cached, which is fine.
   JITSymbol findMangledSymbol(const std::string &Name) {
-    // Search modules in reverse order: from last added to first added.
-    // This is the opposite of the usual search order for dlsym, but makes more
-    // sense in a REPL where we want to bind to the newest available definition.
-    for (auto H : make_range(ModuleHandles.rbegin(), ModuleHandles.rend()))
-      if (auto Sym = CompileLayer.findSymbolIn(H, Name, true))
-        return Sym;
+    if (auto Sym = IndirectStubsMgr->findStub(Name, false))
+      return Sym;
+
+    // The newest definition wins: this is the opposite of the usual search
+    // order for dlsym, but makes more sense in a REPL where we want to bind
+    // to the newest available definition.
+    bool Indexed = false;
+    ModuleHandleT H;
+    {
+      sys::SmartScopedReader<true> Reader(IndexLock);
+      auto Found = SymbolIndex.find(Name);
+      if (Found != SymbolIndex.end()) {
+        const IndexEntry &Newest = Found->second.back();
+        if (Newest.Address)
+          return JITSymbol(Newest.Address, JITSymbolFlags::Exported);
+        Indexed = true;
+        H = Newest.Handle;
+      }
+    }
+    if (Indexed)
+      if (auto Sym = CompileLayer.findSymbolIn(H, Name, true)) {
+        // Linking the module may look up other symbols, so the index is
+        // not locked meanwhile
+        TargetAddress Addr = Sym.getAddress();
+        sys::SmartScopedWriter<true> Writer(IndexLock);
+        for (auto &E : SymbolIndex[Name])
+          if (E.Handle == H)
+            E.Address = Addr;
+        return JITSymbol(Addr, Sym.getFlags());
+      }
 
     // If we can't find the symbol in the JIT, try looking in the host process.
     if (auto SymAddr = RTDyldMemoryManager::getSymbolAddressInProcess(Name))
@@ -103,9 +327,30 @@ private:
 
   std::unique_ptr<TargetMachine> TM;
   const DataLayout DL;
+  // Outlives the memory managers of the layers
+  std::atomic<uint64_t> AllocatedBytes;
   ObjLayerT ObjectLayer;
   CompileLayerT CompileLayer;
-  std::vector<ModuleHandleT> ModuleHandles;
+  // Where every symbol is defined: the modules defining Name, oldest first,
+  // with its address in each once it was looked up. Plus the names each
+  // module added, to take them out again, and the addresses of the stubs.
+  struct IndexEntry {
+    ModuleHandleT Handle;
+    TargetAddress Address;
+  };
+  std::unordered_map<std::string, std::vector<IndexEntry>> SymbolIndex;
+  std::vector<std::pair<ModuleHandleT, std::vector<std::string>>> ModuleSymbols;
+  std::unordered_map<std::string, TargetAddress> StubIndex;
+  std::unique_ptr<IndirectStubsManager> IndirectStubsMgr;
+  std::unique_ptr<JITCompileCallbackManager> CompileCallbackMgr;
+
+  // The tiering thread adds modules and updates stubs too, and so do
+  // compile callbacks, from inside JITed code. Recursive, as
+  // linking a module calls back into findMangledSymbol.
+  std::recursive_mutex JITMutex;
+  // Guards the index: changed while holding JITMutex too, but read by
+  // getSymbolAddress without it.
+  sys::SmartRWMutex<true> IndexLock;
 };
 
 } // End namespace orc.
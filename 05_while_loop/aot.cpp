@@ -0,0 +1,110 @@
+#include "aot.hpp"
+#include "ast.hpp"
+
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/Program.h"
+#include "llvm/Target/TargetMachine.h"
+
+#include <cctype>
+#include <fstream>
+
+extern thread_local std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
+
+/// Functions of the module a C program can call
+static std::vector<Function*> exportedFunctions(Module& M) {
+	std::vector<Function*> res;
+	for (auto &f : M)
+		if (! f.isDeclaration() && f.hasExternalLinkage())
+			res.push_back(&f);
+	return res;
+}
+
+static bool writeObject(Module& M, TargetMachine& TM, const std::string& path) {
+	std::error_code EC;
+	raw_fd_ostream dest(path, EC, sys::fs::F_None);
+	if (EC) {
+		logError("Can't open '" + path + "': " + EC.message());
+		return false;
+	}
+
+	legacy::PassManager PM;
+	if (TM.addPassesToEmitFile(PM, dest, TargetMachine::CGFT_ObjectFile)) {
+		logError("The target can't emit object files");
+		return false;
+	}
+	PM.run(M);
+	dest.flush();
+	return true;
+}
+
+/// Links the object into a shared library with the system compiler driver.
+static bool linkShared(const std::string& objPath, const std::string& soPath) {
+	auto cc = sys::findProgramByName("cc");
+	if (! cc) {
+		logError("Can't find 'cc' to link '" + soPath + "'");
+		return false;
+	}
+
+	const char* args[] = { "cc", "-shared", "-o", soPath.c_str(), objPath.c_str(), "-lm", nullptr };
+	std::string errMsg;
+	if (sys::ExecuteAndWait(*cc, args, nullptr, nullptr, 0, 0, &errMsg) != 0) {
+		logError("Failed linking '" + soPath + "' " + errMsg);
+		return false;
+	}
+	return true;
+}
+
+static bool writeHeader(const std::vector<Function*>& functions, const std::string& path) {
+	std::ofstream out(path);
+	if (! out) {
+		logError("Can't open '" + path + "'");
+		return false;
+	}
+
+	// FOO_H from .../foo.h
+	std::string guard = sys::path::filename(path);
+	for (auto &c : guard)
+		c = isalnum((unsigned char)c) ? toupper((unsigned char)c) : '_';
+
+	out << "/* Generated by kaleidoscope, do not edit. */\n"
+		<< "#ifndef " << guard << "\n"
+		<< "#define " << guard << "\n\n"
+		<< "#ifdef __cplusplus\n"
+		<< "extern \"C\" {\n"
+		<< "#endif\n\n";
+
+	for (auto f : functions) {
+		out << "double " << f->getName().str() << "(";
+		if (f->arg_empty()) out << "void";
+		bool first = true;
+		for (auto &arg : f->args()) {
+			if (! first) out << ", ";
+			out << "double " << arg.getName().str();
+			first = false;
+		}
+		out << ");\n";
+	}
+
+	out << "\n#ifdef __cplusplus\n"
+		<< "}\n"
+		<< "#endif\n\n"
+		<< "#endif /* " << guard << " */\n";
+	return static_cast<bool>(out);
+}
+
+bool emitAOT(const std::string& base) {
+	TargetMachine& TM = TheJIT->getTargetMachine();
+	TheModule->setTargetTriple(TM.getTargetTriple().str());
+	OptimizeModule();
+
+	std::vector<Function*> functions = exportedFunctions(*TheModule);
+	if (! writeHeader(functions, base + ".h")) return false;
+	if (! writeObject(*TheModule, TM, base + ".o")) return false;
+	if (! linkShared(base + ".o", base + ".so")) return false;
+
+	std::cerr << "; wrote " << base << ".o, " << base << ".so and " << base << ".h ("
+		<< functions.size() << " functions)" << std::endl;
+	return true;
+}
@@ -0,0 +1,17 @@
+#ifndef AOT_HPP
+#define AOT_HPP
+
+#include <string>
+
+/// Ahead-of-time compilation (-aot=<base>).
+///
+/// Instead of running anything, every 'def' of the program ends up in
+/// TheModule, which is then optimized and written as <base>.o, linked into
+/// <base>.so and declared in <base>.h (as 'double f(double, ...)'), so C and
+/// C++ code can call the functions without a JIT.
+
+/// Writes <base>.o, <base>.so and <base>.h from TheModule.
+/// Returns false (after reporting why) on failure.
+bool emitAOT(const std::string& base);
+
+#endif /* ifndef AOT_HPP */
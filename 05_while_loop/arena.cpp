@@ -0,0 +1,27 @@
+#include "arena.hpp"
+#include "stats.hpp"
+
+static Statistic NumArenas("arena", "commands parsed into an arena");
+static Statistic NumArenaObjects("arena", "objects allocated in arenas");
+static Statistic NumArenaBytes("arena", "bytes allocated in arenas");
+static Statistic NumArenaSlabs("arena", "slabs allocated by arenas (heap allocations)");
+
+std::shared_ptr<ASTArena> TheASTArena = std::make_shared<ASTArena>();
+
+ASTArena::ASTArena()
+	: m_cleanups(nullptr), m_objects(0)
+{
+	++NumArenas;
+}
+
+ASTArena::~ASTArena() {
+	for (Cleanup* cleanup = m_cleanups; cleanup; cleanup = cleanup->next)
+		cleanup->destroy(cleanup->object);
+	NumArenaObjects += m_objects;
+	NumArenaBytes += m_allocator.getBytesAllocated();
+	NumArenaSlabs += m_allocator.GetNumSlabs();
+}
+
+void newASTArena() {
+	TheASTArena = std::make_shared<ASTArena>();
+}
@@ -0,0 +1,69 @@
+#ifndef ARENA_HPP
+#define ARENA_HPP
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "llvm/Support/Allocator.h"
+
+/// Bump allocation of the syntax tree.
+///
+/// Everything the parser builds for one top-level command (nodes,
+/// prototypes and the lists holding them) goes into the arena of
+/// that command, TheASTArena. Nothing is deleted one by one: the arena runs
+/// the destructors of its objects and frees its slabs in one step when the
+/// last owner lets go of it. A FunctionAST owns the arena of its definition,
+/// the driver drops the arena of a top-level expression once it ran.
+class ASTArena {
+public:
+	ASTArena();
+	~ASTArena();
+
+	/// Constructs a T in the arena.
+	template <typename T, typename... Args>
+	T* make(Args&&... args) {
+		T* object = new (m_allocator.Allocate(sizeof(T), alignof(T))) T(std::forward<Args>(args)...);
+		++m_objects;
+		if (! std::is_trivially_destructible<T>::value) {
+			Cleanup* cleanup = new (m_allocator.Allocate(sizeof(Cleanup), alignof(Cleanup))) Cleanup;
+			cleanup->object = object;
+			cleanup->destroy = [](void* p) { static_cast<T*>(p)->~T(); };
+			cleanup->next = m_cleanups;
+			m_cleanups = cleanup;
+		}
+		return object;
+	}
+
+private:
+	ASTArena(const ASTArena&) = delete;
+	ASTArena& operator=(const ASTArena&) = delete;
+
+	/// A destructor to run, newest first
+	struct Cleanup {
+		Cleanup* next;
+		void (*destroy)(void*);
+		void* object;
+	};
+
+	llvm::BumpPtrAllocator m_allocator;
+	Cleanup* m_cleanups;
+	size_t m_objects;
+};
+
+/// The arena of the command being parsed.
+extern std::shared_ptr<ASTArena> TheASTArena;
+
+/// Gives the next command an arena of its own (the last one goes away
+/// unless a handler kept it).
+void newASTArena();
+
+/// Constructs a T in the arena of the command being parsed.
+template <typename T, typename... Args>
+T* newAST(Args&&... args) {
+	return TheASTArena->make<T>(std::forward<Args>(args)...);
+}
+
+#endif /* ifndef ARENA_HPP */
@@ -1,51 +1,267 @@
 #include "ast.hpp"
+#include "memo.hpp"
+#include "options.hpp"
+#include "passes.hpp"
+#include "ssa.hpp"
+#include "stats.hpp"
+#include "symtab.hpp"
+#include "tiering.hpp"
+
+#include "llvm/Analysis/TargetTransformInfo.h"
+#include "llvm/IR/Intrinsics.h"
+
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
 
 #define INDENT "    "
 
-LLVMContext TheContext;
-IRBuilder<> Builder(TheContext);
-std::unique_ptr<Module> TheModule;
-std::map<std::string, AllocaInst*> NamedValues;
-std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+// Everything needed to generate code is per thread, so the tiering thread
+// can compile in its own context while the main thread keeps going.
+thread_local LLVMContext TheContext;
+thread_local IRBuilder<> Builder(TheContext);
+thread_local std::unique_ptr<Module> TheModule;
+thread_local ScopedSymbolTable<AllocaInst*> NamedValues;
+thread_local std::unique_ptr<legacy::FunctionPassManager> TheFPM;
+/// With -ssa variables are SSA values instead of allocas, see ssa.hpp.
+/// SSAVariables maps the names in scope to their SSABuilder ids.
+thread_local SSABuilder TheSSA;
+static thread_local ScopedSymbolTable<unsigned> SSAVariables;
 std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
-std::map<std::string, PrototypeAST> FunctionProtos;
+
+// Prototypes and definitions are shared by all threads
+std::unordered_map<Symbol, PrototypeAST> FunctionProtos;
+static std::mutex FunctionProtosMutex;
+static std::unordered_map<Symbol, std::shared_ptr<FunctionAST> > FunctionDefs;
+static std::mutex FunctionDefsMutex;
+
+/// Time spent in the function pipeline since the last OptimizeModule()
+static thread_local std::chrono::steady_clock::duration FunctionPassesTime;
+
+/// Set while generating tier 0 code, see emitProfileCounter()
+static thread_local TierProfile* CurrentProfile = nullptr;
+
+/// Types of the body being generated, nullptr without -infer-types
+/// (everything is a double then), see types.hpp
+static thread_local const TypeInference* CurrentTypes = nullptr;
+/// The int body being generated, target of self calls with int arguments
+static thread_local Function* CurrentIntBody = nullptr;
+/// Block of the int body telling the caller its result isn't exact
+static thread_local BasicBlock* CurrentInexactBB = nullptr;
+/// Ints of the int body stay within +-2^53, where doubles are exact
+static const int64_t MaxExactInt = INT64_C(1) << 53;
+
+/// Self calls in tail position of the body being generated: instead of a
+/// call they store the arguments into the parameters and jump back to the
+/// start of the body ('header'), so tail recursion runs in constant stack.
+struct TailRecursion {
+	std::set<const ExprAST*> calls;
+	BasicBlock* header;
+	/// The parameters, as SSA variables (-ssa) or allocas
+	std::vector<unsigned> ssaVars;
+	std::vector<AllocaInst*> addrs;
+	std::vector<KalType> types;
+};
+static thread_local TailRecursion* CurrentTailRecursion = nullptr;
+
+static Statistic NumTailCalls("codegen", "self tail calls turned into jumps");
 
 Value* logError(std::string errMsg) {
 	std::cerr << errMsg << std::endl;
 	return nullptr;
 }
 
-Function* getFunction(std::string name) {
+Function* getFunction(Symbol name) {
 	// We search the given function inside our current module
-	Function* f = TheModule->getFunction(name);
+	Function* f = TheModule->getFunction(name.str());
 	if (f != nullptr) return f;
 
 	// Can we codegen() from some existing prototype?
+	std::unique_lock<std::mutex> lock(FunctionProtosMutex);
 	auto searchRes = FunctionProtos.find(name);
 	if (searchRes != FunctionProtos.end()) {
-		return searchRes->second.codegen();
+		PrototypeAST proto = searchRes->second;
+		lock.unlock();
+		return proto.codegen();
 	}
 
 	// Otherwise, we don't find the required function
 	return nullptr;
 }
 
-AllocaInst* CreateEntryBlockAlloca(Function* TheFunction, const std::string& name) {
+AllocaInst* CreateEntryBlockAlloca(Function* TheFunction, const Twine& name, Type* type) {
 	IRBuilder<> TmpB(&TheFunction->getEntryBlock(), TheFunction->getEntryBlock().begin());
-	return TmpB.CreateAlloca(LLVM_DOUBLETY, 0, name.c_str());
+	return TmpB.CreateAlloca(type ? type : LLVM_DOUBLETY, 0, name);
+}
+
+void addFunctionProto(const PrototypeAST& proto) {
+	std::lock_guard<std::mutex> lock(FunctionProtosMutex);
+	FunctionProtos.erase(proto.name());
+	FunctionProtos.insert(std::make_pair(proto.name(), proto));
+}
+
+void addFunctionDef(std::shared_ptr<FunctionAST> fun) {
+	std::lock_guard<std::mutex> lock(FunctionDefsMutex);
+	FunctionDefs[fun->name()] = fun;
+}
+
+void forgetFunction(Symbol name) {
+	{
+		std::lock_guard<std::mutex> lock(FunctionProtosMutex);
+		FunctionProtos.erase(name);
+	}
+	std::lock_guard<std::mutex> lock(FunctionDefsMutex);
+	FunctionDefs.erase(name);
+}
+
+int functionArity(Symbol name) {
+	std::lock_guard<std::mutex> lock(FunctionProtosMutex);
+	auto searchRes = FunctionProtos.find(name);
+	return searchRes == FunctionProtos.end() ? -1 : (int)searchRes->second.args().size();
+}
+
+std::shared_ptr<FunctionAST> findFunctionDef(Symbol name) {
+	std::lock_guard<std::mutex> lock(FunctionDefsMutex);
+	auto searchRes = FunctionDefs.find(name);
+	return searchRes == FunctionDefs.end() ? nullptr : searchRes->second;
+}
+
+static KalType typeOf(const ExprAST* expr) {
+	return CurrentTypes ? CurrentTypes->typeOf(expr) : KalDouble;
+}
+
+static KalType variableType(const void* decl) {
+	return CurrentTypes ? CurrentTypes->variableType(decl) : KalDouble;
+}
+
+static Type* llvmType(KalType type) {
+	switch (type) {
+		case KalBool: return Type::getInt1Ty(TheContext);
+		case KalInt: return Type::getInt64Ty(TheContext);
+		default: return LLVM_DOUBLETY;
+	}
+}
+
+/// Converts 'value' (i1, i64 or double) to 'type'.
+/// Non-zero values are true, true is 1.
+static Value* convertTo(Value* value, KalType type) {
+	Type* to = llvmType(type);
+	Type* from = value->getType();
+	if (from == to) return value;
+
+	if (from->isDoubleTy()) {
+		if (type == KalInt) return Builder.CreateFPToSI(value, to, "toint");
+		return Builder.CreateFCmpONE(value, LLVM_FP(0.0), "tobool");
+	}
+	if (from->isIntegerTy(1)) {
+		if (type == KalInt) return Builder.CreateZExt(value, to, "toint");
+		return Builder.CreateUIToFP(value, to, "todouble");
+	}
+	if (type == KalDouble) return Builder.CreateSIToFP(value, to, "todouble");
+	return Builder.CreateICmpNE(value, ConstantInt::get(from, 0), "tobool");
+}
+
+/// -ssa: declares a new variable 'name' holding 'value' in the current block,
+/// until the scope of SSAVariables it was declared in is left. Returns its id.
+static unsigned declareSSAVariable(Symbol name, Value* value) {
+	unsigned var = TheSSA.newVariable(name.str(), value->getType());
+	TheSSA.writeVariable(var, Builder.GetInsertBlock(), value);
+	SSAVariables.bind(name, var);
+	return var;
+}
+
+/// -ssa: all predecessors of 'block' are known (no-op without -ssa).
+static void sealBlock(BasicBlock* block) {
+	if (TheOptions.ssa) TheSSA.sealBlock(block);
+}
+
+/// Bumps the tier 0 counter of the function being generated and calls
+/// kal_tier_up() when it reaches the threshold. Emitted on function entry
+/// and on loop back edges, leaves the builder in a fresh block.
+static void emitProfileCounter() {
+	if (CurrentProfile == nullptr) return;
+
+	Function* TheFunction = Builder.GetInsertBlock()->getParent();
+	Type* int64Ty = Type::getInt64Ty(TheContext);
+	Type* int8PtrTy = Type::getInt8PtrTy(TheContext);
+
+	// The profile lives in our memory, so its address is just a constant
+	Value* countAddr = ConstantExpr::getIntToPtr(
+			ConstantInt::get(int64Ty, (uint64_t)&CurrentProfile->count),
+			PointerType::getUnqual(int64Ty));
+	Value* count = Builder.CreateLoad(countAddr, "tiercount");
+	count = Builder.CreateAdd(count, ConstantInt::get(int64Ty, 1), "tiercount");
+	Builder.CreateStore(count, countAddr);
+	Value* isHot = Builder.CreateICmpEQ(count, ConstantInt::get(int64Ty, TheOptions.tierThreshold), "tierhot");
+
+	BasicBlock* tierUpBB = BasicBlock::Create(TheContext, "tier_up", TheFunction);
+	BasicBlock* contBB = BasicBlock::Create(TheContext, "tier_cont", TheFunction);
+	Builder.CreateCondBr(isHot, tierUpBB, contBB);
+	sealBlock(tierUpBB);
+
+	Builder.SetInsertPoint(tierUpBB);
+	FunctionType* hookTy = FunctionType::get(Type::getVoidTy(TheContext), int8PtrTy, false);
+	Value* hook = ConstantExpr::getIntToPtr(
+			ConstantInt::get(int64Ty, (uint64_t)&kal_tier_up),
+			PointerType::getUnqual(hookTy));
+	Value* profile = ConstantExpr::getIntToPtr(
+			ConstantInt::get(int64Ty, (uint64_t)CurrentProfile), int8PtrTy);
+	Builder.CreateCall(hook, profile);
+	Builder.CreateBr(contBB);
+	sealBlock(contBB);
+
+	Builder.SetInsertPoint(contBB);
+}
+
+/// Int body: leaves it unless 'exact', see types.hpp.
+/// Leaves the builder in a fresh block.
+static void exitIfInexact(Value* exact) {
+	Function* TheFunction = Builder.GetInsertBlock()->getParent();
+	BasicBlock* exactBB = BasicBlock::Create(TheContext, "exact", TheFunction);
+	Builder.CreateCondBr(exact, exactBB, CurrentInexactBB);
+	sealBlock(exactBB);
+	Builder.SetInsertPoint(exactBB);
+}
+
+/// Int body: 'left' 'op' 'right' ('+', '-' or '*') on ints within +-2^53,
+/// leaving the int body if the result isn't within that range too.
+static Value* emitExactIntOp(char op, Value* left, Value* right, const Twine& name) {
+	Type* int64Ty = Type::getInt64Ty(TheContext);
+	Value* result;
+	Value* exact = Builder.getTrue();
+	if (op == '*') {
+		Function* smul = Intrinsic::getDeclaration(TheModule.get(), Intrinsic::smul_with_overflow, int64Ty);
+		Value* pair = Builder.CreateCall(smul, {left, right});
+		result = Builder.CreateExtractValue(pair, 0, name);
+		exact = Builder.CreateNot(Builder.CreateExtractValue(pair, 1), "nooverflow");
+	} else {
+		// Sums of operands within +-2^53 can't overflow an i64
+		result = op == '+' ? Builder.CreateAdd(left, right, name) : Builder.CreateSub(left, right, name);
+	}
+	Value* biased = Builder.CreateAdd(result, ConstantInt::get(int64Ty, MaxExactInt));
+	Value* inRange = Builder.CreateICmpULE(biased, ConstantInt::get(int64Ty, 2 * MaxExactInt), "inrange");
+	exitIfInexact(Builder.CreateAnd(exact, inRange, "exact"));
+	return result;
 }
 
 // ====----====----====----====----====----====----====----====----====----====
 // CODEGEN
 // ====----====----====----====----====----====----====----====----====----====
 Value* NumberExprAST::codegen() const {
+	if (typeOf(this) == KalInt) return ConstantInt::get(Type::getInt64Ty(TheContext), (int64_t)m_val);
 	return LLVM_FP(m_val);
 }
 
 Value* VariableExprAST::codegen() const {
-	AllocaInst* varAddres = NamedValues[m_name];
-	if (! varAddres) return logError("Unknown variable: '" + m_name + "'");
-	return Builder.CreateLoad(varAddres);
+	if (TheOptions.ssa) {
+		const unsigned* var = SSAVariables.lookup(m_name);
+		if (! var) return logError("Unknown variable: '" + m_name.str() + "'");
+		return TheSSA.readVariable(*var, Builder.GetInsertBlock());
+	}
+
+	AllocaInst* const* varAddres = NamedValues.lookup(m_name);
+	if (! varAddres) return logError("Unknown variable: '" + m_name.str() + "'");
+	return Builder.CreateLoad(*varAddres);
 	//return Builder.CreateLoad(varAddres, m_name.c_str());
 }
 
@@ -55,8 +271,19 @@ Value* BinaryExprAST::codegen() const {
 		if (! assignMeHomie) return logError("Failed m_right->codegen() in BinaryExprAST::codegen()");
 		VariableExprAST* varAST = dynamic_cast<VariableExprAST*>(m_left);
 		if (varAST == nullptr) return logError("Bad left operand in assignment operator '=' in BinaryExprAST::codegen()");
+		assignMeHomie = convertTo(assignMeHomie, typeOf(m_left));
 
-		return Builder.CreateStore(assignMeHomie, NamedValues[varAST->name()]);
+		if (TheOptions.ssa) {
+			const unsigned* var = SSAVariables.lookup(varAST->name());
+			if (! var) return logError("Unknown variable: '" + varAST->name().str() + "'");
+			TheSSA.writeVariable(*var, Builder.GetInsertBlock(), assignMeHomie);
+			return assignMeHomie;
+		}
+
+		AllocaInst* const* varAddr = NamedValues.lookup(varAST->name());
+		if (! varAddr) return logError("Unknown variable: '" + varAST->name().str() + "'");
+		Builder.CreateStore(assignMeHomie, *varAddr);
+		return assignMeHomie;
 	}
 	Value* left = m_left->codegen();
 	Value* right = m_right->codegen();
@@ -65,18 +292,26 @@ Value* BinaryExprAST::codegen() const {
 		if (!right) std::cerr << "Got nullptr from right operand in BinaryExprAST::codegen()" << std::endl;
 		return nullptr;
 	}
+	if (m_op == ':') return right;
+
+	// Both operands are brought to a common type (all doubles without -infer-types),
+	// int math happens in int bodies only
+	const bool isInt = m_op == '<' || m_op == '>'
+		? arithmeticType(typeOf(m_left), typeOf(m_right)) == KalInt
+		: typeOf(this) == KalInt;
+	left = convertTo(left, isInt ? KalInt : KalDouble);
+	right = convertTo(right, isInt ? KalInt : KalDouble);
 	switch (m_op) {
-		case '+': return Builder.CreateFAdd(left, right, "tmpadd");
-		case '-': return Builder.CreateFSub(left, right, "tmpsub");
-		case '*': return Builder.CreateFMul(left, right, "tmpmul");
-		case ':': return right;
+		case '+': return isInt ? emitExactIntOp('+', left, right, "tmpadd") : Builder.CreateFAdd(left, right, "tmpadd");
+		case '-': return isInt ? emitExactIntOp('-', left, right, "tmpsub") : Builder.CreateFSub(left, right, "tmpsub");
+		case '*': return isInt ? emitExactIntOp('*', left, right, "tmpmul") : Builder.CreateFMul(left, right, "tmpmul");
 		case '<':
-			// CreateFCmpULT returns a 1bit integer which we must covnert to a double
-			left = Builder.CreateFCmpULT(left, right, "cmplt");
-			return Builder.CreateUIToFP(left, Type::getDoubleTy(TheContext), "boollt");
+			// The comparisons return a 1bit integer which we must covnert to a double (unless typed)
+			left = isInt ? Builder.CreateICmpSLT(left, right, "cmplt") : Builder.CreateFCmpULT(left, right, "cmplt");
+			return convertTo(left, typeOf(this));
 		case '>':
-			left = Builder.CreateFCmpUGT(left, right, "cmpgt");
-			return Builder.CreateUIToFP(left, Type::getDoubleTy(TheContext), "boolgt");
+			left = isInt ? Builder.CreateICmpSGT(left, right, "cmpgt") : Builder.CreateFCmpUGT(left, right, "cmpgt");
+			return convertTo(left, typeOf(this));
 		default:
 			std::cout << "Unknown binary operator '" << m_op << "'" << std::endl;
 			return nullptr;
@@ -86,15 +321,29 @@ Value* BinaryExprAST::codegen() const {
 }
 
 Value* VarDefExprAST::codegen() const {
-	std::vector<AllocaInst*> oldVarAddresses;
+	// Leaving the scope brings back whatever the variables shadowed, in
+	// reverse (a name may be declared twice: 'var x = 1, x = x + 1')
+	if (TheOptions.ssa) {
+		size_t scope = SSAVariables.enterScope();
+		for (auto &ass : m_varDeclDefs) {
+			// The initializer still sees the outer variable of the same name
+			Value* initVal = ass.second ? ass.second->codegen() : LLVM_FP(0.0);
+			if (! initVal) return logError("Failed codegen() in VarDefExprAST::codegen()");
+			declareSSAVariable(ass.first, convertTo(initVal, variableType(&ass)));
+		}
+
+		Value* bodyExpr = m_innerExpr->codegen();
+		if (! bodyExpr) return logError("Failed m_innerExpr->codegen() in VarDefExprAST::codegen()");
+		SSAVariables.leaveScope(scope);
+		return bodyExpr;
+	}
+
 	Function* TheFunction = Builder.GetInsertBlock()->getParent();
+	size_t scope = NamedValues.enterScope();
 
 	// We iterate over a list of decl-assignments
-	// Ex. i = 1, j, k = 2  <- <string, ExprAST*>
+	// Ex. i = 1, j, k = 2  <- <Symbol, ExprAST*>
 	for (auto &ass : m_varDeclDefs) {
-		// We save the old variable address
-		oldVarAddresses.push_back(NamedValues[ass.first]);
-
 		// Calculate the value to assign to var (default is 0.0)
 		Value* initVal = nullptr;
 		if (ass.second == nullptr) {
@@ -105,21 +354,17 @@ Value* VarDefExprAST::codegen() const {
 		}
 
 		// Fetch a new addr for a given variable
-		NamedValues[ass.first] = CreateEntryBlockAlloca(TheFunction, ass.first);
+		KalType type = variableType(&ass);
+		AllocaInst* varAddr = CreateEntryBlockAlloca(TheFunction, ass.first.str(), llvmType(type));
 		// And store a value on it
-		Builder.CreateStore(initVal, NamedValues[ass.first]);
+		Builder.CreateStore(convertTo(initVal, type), varAddr);
+		NamedValues.bind(ass.first, varAddr);
 	}
 
 	// We execute the body expression
 	Value* bodyExpr = m_innerExpr->codegen();
 	if (! bodyExpr) return logError("Failed m_innerExpr->codegen() in VarDefExprAST::codegen()");
-
-	// We restore old var address (and remove ones we've added and didn't exist before)
-	unsigned i = 0;
-	for (auto &ass : m_varDeclDefs) {
-		if (ass.second == nullptr) NamedValues.erase(ass.first);
-		else NamedValues[ass.first] = oldVarAddresses[i++];
-	}
+	NamedValues.leaveScope(scope);
 	return bodyExpr;
 }
 
@@ -131,20 +376,50 @@ Value* IfThenElseExprAST::codegen() const {
 	if (! cond) return logError("Failed m_cond->codegen() in IfThenElseExprAST::codegen()");
 	Function* TheFunction = Builder.GetInsertBlock()->getParent();
 
-	// Allocate memory for some random var and backup old value
-	std::string ifthenVar = "ifthenvar";
-	AllocaInst* ifThenAddr = CreateEntryBlockAlloca(TheFunction, ifthenVar);
-	auto finder = NamedValues.find(ifthenVar);
-	AllocaInst* oldVarAddr = (finder == NamedValues.end() ? nullptr : NamedValues[ifthenVar]);
-	NamedValues[ifthenVar] = ifThenAddr;
+	// Without allocas, the result is the PHI of both branches
+	if (TheOptions.ssa) {
+		BasicBlock* thenBB = BasicBlock::Create(TheContext, "then_if", TheFunction);
+		BasicBlock* elseBB = BasicBlock::Create(TheContext, "else_if");
+		BasicBlock* mergeBB = BasicBlock::Create(TheContext, "merge_if");
+
+		Builder.CreateCondBr(convertTo(cond, KalBool), thenBB, elseBB);
+		sealBlock(thenBB);
+		sealBlock(elseBB);
+
+		Builder.SetInsertPoint(thenBB);
+		Value* thenVal = m_thenExpr->codegen();
+		if (! thenVal) return logError("Failed m_thenExpr->codegen() in IfThenElseExprAST::codegen()");
+		thenVal = convertTo(thenVal, typeOf(this));
+		Builder.CreateBr(mergeBB);
+		thenBB = Builder.GetInsertBlock();
+
+		TheFunction->getBasicBlockList().push_back(elseBB);
+		Builder.SetInsertPoint(elseBB);
+		Value* elseVal = m_elseExpr->codegen();
+		if (! elseVal) return logError("Failed m_elseExpr->codegen() in IfThenElseExprAST::codegen()");
+		elseVal = convertTo(elseVal, typeOf(this));
+		Builder.CreateBr(mergeBB);
+		elseBB = Builder.GetInsertBlock();
+
+		TheFunction->getBasicBlockList().push_back(mergeBB);
+		Builder.SetInsertPoint(mergeBB);
+		sealBlock(mergeBB);
+
+		PHINode* thePHI = Builder.CreatePHI(llvmType(typeOf(this)), 2, "phitmp");
+		thePHI->addIncoming(thenVal, thenBB);
+		thePHI->addIncoming(elseVal, elseBB);
+		return thePHI;
+	}
+
+	// Allocate memory for the result (not a variable, so it isn't in scope)
+	AllocaInst* ifThenAddr = CreateEntryBlockAlloca(TheFunction, "ifthenvar", llvmType(typeOf(this)));
 
 	// Create required basic blocks
 	BasicBlock* thenBB = BasicBlock::Create(TheContext, "then_if", TheFunction);
 	BasicBlock* elseBB = BasicBlock::Create(TheContext, "else_if");
 	BasicBlock* mergeBB = BasicBlock::Create(TheContext, "merge_if");
 
-	cond = Builder.CreateFCmpONE(cond, LLVM_FP(0.0), "ifcond");
-	Builder.CreateCondBr(cond, thenBB, elseBB);
+	Builder.CreateCondBr(convertTo(cond, KalBool), thenBB, elseBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 	// HANDLING THEN
@@ -152,7 +427,7 @@ Value* IfThenElseExprAST::codegen() const {
 	Builder.SetInsertPoint(thenBB);
 	Value* thenVal = m_thenExpr->codegen();
 	if (! thenVal) return logError("Failed m_thenExpr->codegen() in IfThenElseExprAST::codegen()");
-	Builder.CreateStore(thenVal, ifThenAddr);
+	Builder.CreateStore(convertTo(thenVal, typeOf(this)), ifThenAddr);
 	Builder.CreateBr(mergeBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
@@ -162,7 +437,7 @@ Value* IfThenElseExprAST::codegen() const {
 	Builder.SetInsertPoint(elseBB);
 	Value* elseVal = m_elseExpr->codegen();
 	if (! elseVal) return logError("Failed m_elseExpr->codegen() in IfThenElseExprAST::codegen()");
-	Builder.CreateStore(elseVal, ifThenAddr);
+	Builder.CreateStore(convertTo(elseVal, typeOf(this)), ifThenAddr);
 	Builder.CreateBr(mergeBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
@@ -170,13 +445,7 @@ Value* IfThenElseExprAST::codegen() const {
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 	TheFunction->getBasicBlockList().push_back(mergeBB);
 	Builder.SetInsertPoint(mergeBB);
-	Value* retVal = Builder.CreateLoad(ifThenAddr, "ifload");
-
-	// Restore old value in NamedValues
-	if (oldVarAddr == nullptr) NamedValues.erase(ifthenVar);
-	else NamedValues[ifthenVar] = oldVarAddr;
-
-	return retVal;
+	return Builder.CreateLoad(ifThenAddr, "ifload");
 //	Value* cond = m_cond->codegen();
 //	if (! cond)
 //		return logError("Got nullptr from m_cond->codegen() in IfThenElseExprAST");
@@ -225,20 +494,26 @@ Value* IfThenElseExprAST::codegen() const {
 Value* ForExprAST::codegen() const {
 	Value* startVal = m_init->codegen();
 	if (! startVal) return logError("Faileed m_init->codegen() in ForExprAST::codegen()");
-
-	// Save old variable stack address
-	auto finder = NamedValues.find(m_varName);
-	AllocaInst* oldVarAddr = (finder == NamedValues.end() ? nullptr : finder->second);
+	const KalType varType = variableType(this);
+	startVal = convertTo(startVal, varType);
 
 	Function* TheFunction = Builder.GetInsertBlock()->getParent();
 	//BasicBlock* preLoopBB = Builder.GetInsertBlock();
 
-	// Get ourselves an stack address for loop var
-	AllocaInst* loopVarAddr = CreateEntryBlockAlloca(TheFunction, m_varName);
-	// We store the initial value onto our loop variable
-	Builder.CreateStore(startVal, loopVarAddr);
-	// And remeber its addres in symtable (so other parts of syntree can access the var)
-	NamedValues[m_varName] = loopVarAddr;
+	// The loop variable is in scope until the end of the loop
+	size_t scope = TheOptions.ssa ? SSAVariables.enterScope() : NamedValues.enterScope();
+	AllocaInst* loopVarAddr = nullptr;
+	unsigned loopVar = 0;
+	if (TheOptions.ssa) {
+		loopVar = declareSSAVariable(m_varName, startVal);
+	} else {
+		// Get ourselves an stack address for loop var
+		loopVarAddr = CreateEntryBlockAlloca(TheFunction, m_varName.str(), llvmType(varType));
+		// We store the initial value onto our loop variable
+		Builder.CreateStore(startVal, loopVarAddr);
+		// And remeber its addres in symtable (so other parts of syntree can access the var)
+		NamedValues.bind(m_varName, loopVarAddr);
+	}
 
 	// Get ourselves some basic blocks
 	BasicBlock* entryBB = BasicBlock::Create(TheContext, "entryLoop", TheFunction);
@@ -253,9 +528,10 @@ Value* ForExprAST::codegen() const {
 	Builder.SetInsertPoint(entryBB);
 	Value* cond = m_cond->codegen();
 	if (! cond) return logError("Failed m_cond->codegen() in ForExprAST::codegen()");
-	cond = Builder.CreateFCmpONE(cond, LLVM_FP(0.0), "forcmp");
-	Builder.CreateCondBr(cond, loopBB, endBB);
-	entryBB = Builder.GetInsertBlock(); // NOTE: added
+	Builder.CreateCondBr(convertTo(cond, KalBool), loopBB, endBB);
+	// The back edge goes to entryBB, so the whole condition is evaluated again
+	sealBlock(loopBB);
+	sealBlock(endBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 	// HANDLE LOOP BODY
@@ -273,10 +549,18 @@ Value* ForExprAST::codegen() const {
 		loopStep = m_step->codegen();
 		if (! loopStep) return logError("Failed m_step->codegen() in ForExprAST::codegen()");
 	}
-	Value* loopVarVal = Builder.CreateLoad(loopVarAddr);
-	Value* newVal = Builder.CreateFAdd(loopVarVal, loopStep);
-	Builder.CreateStore(newVal, loopVarAddr);
+	loopStep = convertTo(loopStep, varType);
+	Value* loopVarVal = TheOptions.ssa
+		? TheSSA.readVariable(loopVar, Builder.GetInsertBlock())
+		: Builder.CreateLoad(loopVarAddr);
+	Value* newVal = varType == KalInt
+		? emitExactIntOp('+', loopVarVal, loopStep, "nextvar")
+		: Builder.CreateFAdd(loopVarVal, loopStep, "nextvar");
+	if (TheOptions.ssa) TheSSA.writeVariable(loopVar, Builder.GetInsertBlock(), newVal);
+	else Builder.CreateStore(newVal, loopVarAddr);
+	emitProfileCounter();
 	Builder.CreateBr(entryBB);
+	sealBlock(entryBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 	// HANDLE LOOP END
@@ -285,10 +569,10 @@ Value* ForExprAST::codegen() const {
 	Builder.SetInsertPoint(endBB);
 
 	// Restore old var
-	if (oldVarAddr == nullptr) NamedValues.erase(m_varName);
-	else NamedValues[m_varName] = oldVarAddr;
+	if (TheOptions.ssa) SSAVariables.leaveScope(scope);
+	else NamedValues.leaveScope(scope);
 
-	return LLVM_FP(0.0);
+	return Constant::getNullValue(llvmType(typeOf(this)));
 }
 
 Value* WhileExprAST::codegen() const {
@@ -307,9 +591,9 @@ Value* WhileExprAST::codegen() const {
 	Builder.SetInsertPoint(entryBB);
 	Value* condVal = m_cond->codegen();
 	if (! condVal) return logError("Failed m_cond->codegen() in WhileExprAST::codegen()");
-	condVal = Builder.CreateFCmpONE(condVal, LLVM_FP(0.0), "forcmp");
-	Builder.CreateCondBr(condVal, loopBB, endBB);
-	entryBB = Builder.GetInsertBlock();
+	Builder.CreateCondBr(convertTo(condVal, KalBool), loopBB, endBB);
+	sealBlock(loopBB);
+	sealBlock(endBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 	// HANDLE LOOP BODY
@@ -318,7 +602,9 @@ Value* WhileExprAST::codegen() const {
 	Builder.SetInsertPoint(loopBB);
 	Value* bodyVal = m_body->codegen();
 	if (! bodyVal) return logError("Failed m_body->codegen() in WhileExprAST::codegen()");
+	emitProfileCounter();
 	Builder.CreateBr(entryBB);
+	sealBlock(entryBB);
 
 	// =-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-=-
 	// HANDLE LOOP END
@@ -326,14 +612,14 @@ Value* WhileExprAST::codegen() const {
 	TheFunction->getBasicBlockList().push_back(endBB);
 	Builder.SetInsertPoint(endBB);
 
-	return LLVM_FP(0.0);
+	return Constant::getNullValue(llvmType(typeOf(this)));
 }
 
 Value* CallExprAST::codegen() const {
 	// We try to fetch the function
 	Function* theFunction = getFunction(m_name);
 	if (! theFunction) {
-		std::cerr << "Failed finding function: '" << m_name << "'" << std::endl;
+		std::cerr << "Failed finding function: '" << m_name.str() << "'" << std::endl;
 		return nullptr;
 	}
 
@@ -344,31 +630,246 @@ Value* CallExprAST::codegen() const {
 		return nullptr;
 	}
 
+	// Self calls with int arguments stay in the int body (see types.hpp),
+	// everything else takes doubles
+	KalType argType = KalDouble;
+	const bool callsIntBody = CurrentIntBody && CurrentTypes->callsIntBody(this);
+	if (callsIntBody) {
+		theFunction = CurrentIntBody;
+		argType = KalInt;
+	}
+
+	// A self call in tail position becomes a jump (in the int body only
+	// if it stays in the int body)
+	TailRecursion* tail = CurrentTailRecursion;
+	if (tail && tail->calls.count(this) && (! CurrentIntBody || callsIntBody)) {
+		// All arguments first, they may read the parameters
+		std::vector<Value*> args;
+		for (unsigned i = 0; i < m_exps.size(); ++i) {
+			Value* argVal = m_exps[i]->codegen();
+			if (! argVal) return logError("Failed codegen() of an argument of '" + m_name.str() + "'");
+			args.push_back(convertTo(argVal, tail->types[i]));
+		}
+		for (unsigned i = 0; i < args.size(); ++i) {
+			if (TheOptions.ssa) TheSSA.writeVariable(tail->ssaVars[i], Builder.GetInsertBlock(), args[i]);
+			else Builder.CreateStore(args[i], tail->addrs[i]);
+		}
+		// It's a back edge for tiering
+		emitProfileCounter();
+		Builder.CreateBr(tail->header);
+		++NumTailCalls;
+
+		// Whatever follows is dead, but the caller still wants a value
+		Function* TheFunction = Builder.GetInsertBlock()->getParent();
+		BasicBlock* deadBB = BasicBlock::Create(TheContext, "after_tailcall", TheFunction);
+		Builder.SetInsertPoint(deadBB);
+		sealBlock(deadBB);
+		return UndefValue::get(callsIntBody ? llvmType(CurrentTypes->returnType()) : LLVM_DOUBLETY);
+	}
+
 	// We create arguments
 	std::vector<Value*> args;
-	for (auto & arg : m_exps)
-		args.push_back(arg->codegen());
-	return Builder.CreateCall(theFunction, args, "calltmp");
+	for (auto & arg : m_exps) {
+		Value* argVal = arg->codegen();
+		if (! argVal) return logError("Failed codegen() of an argument of '" + m_name.str() + "'");
+		args.push_back(convertTo(argVal, argType));
+	}
+	if (! callsIntBody) return Builder.CreateCall(theFunction, args, "calltmp");
+
+	// An inexact result leaves all the int bodies up to the entry point
+	Value* result = Builder.CreateCall(theFunction, args, "calltmp");
+	exitIfInexact(Builder.CreateExtractValue(result, 1, "exact"));
+	return Builder.CreateExtractValue(result, 0, "intresult");
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// TAIL CALLS
+// ====----====----====----====----====----====----====----====----====----====
+void BinaryExprAST::findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const {
+	// 'a : b' is worth b
+	if (m_op == ':') m_right->findTailCalls(name, arity, calls);
+}
+
+void VarDefExprAST::findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const {
+	m_innerExpr->findTailCalls(name, arity, calls);
+}
+
+void IfThenElseExprAST::findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const {
+	m_thenExpr->findTailCalls(name, arity, calls);
+	m_elseExpr->findTailCalls(name, arity, calls);
+}
+
+void CallExprAST::findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const {
+	if (m_name == name && m_exps.size() == arity) calls.insert(this);
 }
 
 Function* PrototypeAST::codegen() const {
 	std::vector<Type*> protoParameters(m_args.size(), Type::getDoubleTy(TheContext));
 	FunctionType* ftype = FunctionType::get(Type::getDoubleTy(TheContext), protoParameters, false);
-	Function* theFunction = Function::Create(ftype, Function::ExternalLinkage, m_name, TheModule.get());
+	Function* theFunction = Function::Create(ftype, Function::ExternalLinkage, m_name.str(), TheModule.get());
 
 	// Set function names for args (not required but sexy)
 	unsigned areSexy = 0;
 	for (auto &argument : theFunction->args())
-		argument.setName(m_args[areSexy++]); 		// my args are sexy no?
+		argument.setName(m_args[areSexy++].str()); 		// my args are sexy no?
 
-	FunctionProtos.insert(std::pair<std::string, PrototypeAST>(m_name, *this));
+	std::lock_guard<std::mutex> lock(FunctionProtosMutex);
+	FunctionProtos.insert(std::make_pair(m_name, *this));
 	return theFunction;
 }
 
+/// Tells the backend (and inliner) which CPU the code is for, and if its
+/// floating point math may be reassociated.
+static void setFunctionAttributes(Function* theFunction, const PrototypeAST& proto) {
+	if (TheJIT) {
+		TargetMachine& TM = TheJIT->getTargetMachine();
+		theFunction->addFnAttr("target-cpu", TM.getTargetCPU());
+		theFunction->addFnAttr("target-features", TM.getTargetFeatureString());
+	}
+	if (TheOptions.fastMath || proto.isFast()) {
+		theFunction->addFnAttr("unsafe-fp-math", "true");
+		theFunction->addFnAttr("no-nans-fp-math", "true");
+		theFunction->addFnAttr("no-infs-fp-math", "true");
+	}
+}
+
+/// Gives 'theFunction' its entry block and forgets the variables of the
+/// function generated before.
+static void beginFunctionBody(Function* theFunction) {
+	BasicBlock* funBB = BasicBlock::Create(TheContext, "entry", theFunction);
+	Builder.SetInsertPoint(funBB);
+	NamedValues.clear();
+	if (TheOptions.ssa) {
+		TheSSA.clear();
+		SSAVariables.clear();
+		sealBlock(funBB);
+	}
+}
+
+/// Generates 'wrapper' around the memoized 'body': a lookup of the
+/// arguments in 'table', and on a miss a call to 'body' whose result is
+/// inserted. Calls to the hooks go to constant addresses, like tiering's.
+static void emitMemoWrapper(Function* wrapper, Function* body, MemoTable* table) {
+	Type* int64Ty = Type::getInt64Ty(TheContext);
+	Type* int32Ty = Type::getInt32Ty(TheContext);
+	Type* int8PtrTy = Type::getInt8PtrTy(TheContext);
+	Type* doublePtrTy = PointerType::getUnqual(LLVM_DOUBLETY);
+
+	beginFunctionBody(wrapper);
+	// The arguments are passed to the hooks as an array
+	ArrayType* argsTy = ArrayType::get(LLVM_DOUBLETY, wrapper->arg_size());
+	AllocaInst* argsAddr = CreateEntryBlockAlloca(wrapper, "memoargs", argsTy);
+	AllocaInst* resultAddr = CreateEntryBlockAlloca(wrapper, "memoresult");
+	std::vector<Value*> args;
+	unsigned i = 0;
+	for (auto &argument : wrapper->args()) {
+		Builder.CreateStore(&argument, Builder.CreateConstGEP2_32(argsTy, argsAddr, 0, i++));
+		args.push_back(&argument);
+	}
+	Value* argsPtr = Builder.CreateConstGEP2_32(argsTy, argsAddr, 0, 0, "memoargsptr");
+	Value* tablePtr = ConstantExpr::getIntToPtr(ConstantInt::get(int64Ty, (uint64_t)table), int8PtrTy);
+
+	FunctionType* lookupTy = FunctionType::get(int32Ty, {int8PtrTy, doublePtrTy, doublePtrTy}, false);
+	Value* lookup = ConstantExpr::getIntToPtr(
+			ConstantInt::get(int64Ty, (uint64_t)&kal_memo_lookup), PointerType::getUnqual(lookupTy));
+	Value* hit = Builder.CreateCall(lookup, {tablePtr, argsPtr, resultAddr}, "memohit");
+
+	BasicBlock* hitBB = BasicBlock::Create(TheContext, "memo_hit", wrapper);
+	BasicBlock* missBB = BasicBlock::Create(TheContext, "memo_miss", wrapper);
+	Builder.CreateCondBr(Builder.CreateICmpNE(hit, ConstantInt::get(int32Ty, 0)), hitBB, missBB);
+
+	Builder.SetInsertPoint(hitBB);
+	Builder.CreateRet(Builder.CreateLoad(resultAddr, "memoresult"));
+
+	Builder.SetInsertPoint(missBB);
+	Value* result = Builder.CreateCall(body, args, "result");
+	FunctionType* insertTy = FunctionType::get(Type::getVoidTy(TheContext),
+			{int8PtrTy, doublePtrTy, LLVM_DOUBLETY}, false);
+	Value* insert = ConstantExpr::getIntToPtr(
+			ConstantInt::get(int64Ty, (uint64_t)&kal_memo_insert), PointerType::getUnqual(insertTy));
+	Builder.CreateCall(insert, {tablePtr, argsPtr, result});
+	Builder.CreateRet(result);
+	verifyFunction(*wrapper);
+}
+
+/// Declares the parameters of 'theFunction', then generates the body of
+/// the definition at the insert point, typed by 'types' (nullptr for all
+/// doubles), and returns its value. Returns false if codegen failed.
+bool FunctionAST::codegenBody(Function* theFunction, const TypeInference* types) const {
+	CurrentTypes = types;
+
+	TailRecursion tail;
+	// A memoized body calls itself through the cache, a jump would skip it
+	if (! m_memoTable) m_definition->findTailCalls(m_proto.name(), m_proto.args().size(), tail.calls);
+
+	// Now we set arguments into namedValues so function can use it
+	unsigned i = 0;
+	for (auto &argument : theFunction->args()) {
+		Symbol name = m_proto.args()[i];
+		KalType type = variableType(&m_proto.args()[i++]);
+		Value* value = convertTo(&argument, type);
+		if (TheOptions.ssa) {
+			tail.ssaVars.push_back(declareSSAVariable(name, value));
+		} else {
+			AllocaInst* argAddr = CreateEntryBlockAlloca(theFunction, name.str(), value->getType());
+			NamedValues.bind(name, argAddr);
+			Builder.CreateStore(value, argAddr);
+			tail.addrs.push_back(argAddr);
+		}
+		tail.types.push_back(type);
+	}
+	emitProfileCounter();
+
+	// The int body returns its result and whether it's exact
+	BasicBlock* inexactBB = nullptr;
+	if (theFunction == CurrentIntBody) {
+		StructType* retType = cast<StructType>(theFunction->getReturnType());
+		inexactBB = BasicBlock::Create(TheContext, "inexact");
+		IRBuilder<> inexact(inexactBB);
+		inexact.CreateRet(ConstantStruct::get(retType,
+				{UndefValue::get(retType->getElementType(0)), ConstantInt::getFalse(TheContext)}));
+		CurrentInexactBB = inexactBB;
+	}
+
+	// Tail calls jump here
+	if (! tail.calls.empty()) {
+		tail.header = BasicBlock::Create(TheContext, "tailrecurse", theFunction);
+		Builder.CreateBr(tail.header);
+		Builder.SetInsertPoint(tail.header);
+		CurrentTailRecursion = &tail;
+	}
+
+	Value* functionBody = m_definition->codegen();
+	CurrentTypes = nullptr;
+	CurrentTailRecursion = nullptr;
+	CurrentInexactBB = nullptr;
+	if (! tail.calls.empty()) sealBlock(tail.header);
+	if (inexactBB) {
+		// Even if codegen failed, so it goes away with the function
+		theFunction->getBasicBlockList().push_back(inexactBB);
+		sealBlock(inexactBB);
+	}
+	if (functionBody == nullptr) return false;
+
+	if (inexactBB) {
+		Value* result = convertTo(functionBody, types->returnType());
+		Value* pair = UndefValue::get(theFunction->getReturnType());
+		pair = Builder.CreateInsertValue(pair, result, 0);
+		Builder.CreateRet(Builder.CreateInsertValue(pair, Builder.getTrue(), 1));
+	} else {
+		Builder.CreateRet(convertTo(functionBody, KalDouble));
+	}
+	verifyFunction(*theFunction); 		// verify the function
+	return true;
+}
+
 Function* FunctionAST::codegen() const {
 	// We must take care here, we wish for the function NOT to have a body
 	// here (only a declaration).
 	// We check if some functions already exists with the same name
+	// (code of the module may use a declaration that is already there,
+	// then a failed codegen only takes the body away again)
+	const bool wasDeclared = TheModule->getFunction(m_proto.name().str()) != nullptr;
 	Function* theFunction = getFunction(m_proto.name());
 
 	// If function doesn't exist, we start by generating a declaration from it
@@ -380,36 +881,215 @@ Function* FunctionAST::codegen() const {
 
 	// Finally, what if function function actually exists and has a body?
 	if (! theFunction->empty())
-		return (Function*)logError("Function '" + m_proto.name() + "' can't be redefined.");
+		return (Function*)logError("Function '" + m_proto.name().str() + "' can't be redefined.");
+
+	// With fast-math every floating point instruction of the body may be
+	// reassociated, so reductions in loops can be reordered and vectorized
+	IRBuilderBase::FastMathFlagGuard fmfGuard(Builder);
+	FastMathFlags FMF;
+	if (TheOptions.fastMath || m_proto.isFast()) FMF.setUnsafeAlgebra();
+	Builder.setFastMathFlags(FMF);
+	setFunctionAttributes(theFunction, m_proto);
+
+	// Without -infer-types there are no types, just doubles
+	std::unique_ptr<TypeInference> types, intTypes;
+	if (TheOptions.inferTypes) {
+		types.reset(new TypeInference(*this, KalDouble));
+		// The int body would call itself around the cache
+		if (! m_proto.args().empty() && ! m_memoTable) {
+			intTypes.reset(new TypeInference(*this, KalInt));
+			// Running the double body after all must not repeat side effects
+			if (! intTypes->hasIntParameter() || ! intTypes->isClosed()) intTypes.reset();
+		}
+	}
+
+	// A memoized function is a wrapper looking its arguments up in the
+	// cache, the body gets a function of its own (see memo.hpp)
+	Function* body = theFunction;
+	if (m_memoTable) {
+		body = Function::Create(theFunction->getFunctionType(), Function::InternalLinkage,
+				m_proto.name().str() + "$memo", TheModule.get());
+		unsigned i = 0;
+		for (auto &argument : body->args())
+			argument.setName(m_proto.args()[i++].str());
+		setFunctionAttributes(body, m_proto);
+	}
+
+	// The int body goes first, the double one calls it
+	Function* intBody = nullptr;
+	if (intTypes) {
+		std::vector<Type*> intParameters(m_proto.args().size(), Type::getInt64Ty(TheContext));
+		Type* retType = StructType::get(TheContext, {llvmType(intTypes->returnType()), Type::getInt1Ty(TheContext)});
+		FunctionType* ftype = FunctionType::get(retType, intParameters, false);
+		// Every module gets its own copy
+		intBody = Function::Create(ftype, Function::InternalLinkage, m_proto.name().str() + "$int", TheModule.get());
+		unsigned i = 0;
+		for (auto &argument : intBody->args())
+			argument.setName(m_proto.args()[i++].str());
+		setFunctionAttributes(intBody, m_proto);
+
+		beginFunctionBody(intBody);
+		CurrentIntBody = intBody;
+		bool ok = codegenBody(intBody, intTypes.get());
+		CurrentIntBody = nullptr;
+		if (! ok) {
+			intBody->eraseFromParent();
+			if (body != theFunction) body->eraseFromParent();
+			if (wasDeclared) theFunction->deleteBody();
+			else theFunction->eraseFromParent();
+			return (Function*)logError("Failed generating code for function definition of '" + m_proto.name().str() + "'");
+		}
+	}
 
 	// Now we give our function a basic block in which we shall dump it's definition
-	BasicBlock* funBB = BasicBlock::Create(TheContext, "entry", theFunction);
-	Builder.SetInsertPoint(funBB);
+	beginFunctionBody(body);
+	if (intBody) {
+		// Integer arguments (within +-2^53) take the int body
+		Type* int64Ty = Type::getInt64Ty(TheContext);
+		Value* allInts = Builder.getTrue();
+		std::vector<Value*> intArgs;
+		for (auto &argument : body->args()) {
+			Value* inRange = Builder.CreateAnd(
+					Builder.CreateFCmpOGE(&argument, LLVM_FP(-(double)MaxExactInt)),
+					Builder.CreateFCmpOLE(&argument, LLVM_FP((double)MaxExactInt)), "inrange");
+			// fptosi of values out of range is undefined
+			Value* inRangeArg = Builder.CreateSelect(inRange, &argument, LLVM_FP(0.0));
+			Value* intArg = Builder.CreateFPToSI(inRangeArg, int64Ty, argument.getName() + "int");
+			Value* isInt = Builder.CreateFCmpOEQ(Builder.CreateSIToFP(intArg, LLVM_DOUBLETY), &argument);
+			allInts = Builder.CreateAnd(allInts, Builder.CreateAnd(inRange, isInt), "allints");
+			intArgs.push_back(intArg);
+		}
 
-	// Now we set arguments into namedValues so function can use it
-	NamedValues.clear();
-	for (auto &argument : theFunction->args()) {
-		AllocaInst* argAddr = CreateEntryBlockAlloca(theFunction, argument.getName());
-		NamedValues[argument.getName()] = argAddr;
-		Builder.CreateStore(&argument, argAddr);
+		BasicBlock* intBB = BasicBlock::Create(TheContext, "int_args", body);
+		BasicBlock* exactBB = BasicBlock::Create(TheContext, "exact", body);
+		BasicBlock* doubleBB = BasicBlock::Create(TheContext, "double_args", body);
+		Builder.CreateCondBr(allInts, intBB, doubleBB);
+		sealBlock(intBB);
+
+		// An inexact result runs the double body from the start
+		Builder.SetInsertPoint(intBB);
+		Value* result = Builder.CreateCall(intBody, intArgs, "intresult");
+		Builder.CreateCondBr(Builder.CreateExtractValue(result, 1, "exact"), exactBB, doubleBB);
+		sealBlock(exactBB);
+		sealBlock(doubleBB);
+
+		Builder.SetInsertPoint(exactBB);
+		Builder.CreateRet(convertTo(Builder.CreateExtractValue(result, 0), KalDouble));
+
+		Builder.SetInsertPoint(doubleBB);
 	}
 
 	// Finally, we try to generate the function body and function return value
-	Value* functionBody = m_definition->codegen();
-	if (functionBody == nullptr) {
-		theFunction->eraseFromParent(); // we delete the function from the symtable
-		return (Function*)logError("Failed generating code for function definition of '" + m_proto.name() + "'");
-	} else {
-		Builder.CreateRet(functionBody);
-		verifyFunction(*theFunction); 		// verify the function
-		TheFPM->run(*theFunction); 			// optimize this function
-		return theFunction;
+	if (! codegenBody(body, types.get())) {
+		if (intBody) intBody->eraseFromParent();
+		if (body != theFunction) body->eraseFromParent();
+		if (wasDeclared) theFunction->deleteBody();
+		else theFunction->eraseFromParent(); // we delete the function from the symtable
+		return (Function*)logError("Failed generating code for function definition of '" + m_proto.name().str() + "'");
 	}
+
+	if (body != theFunction) emitMemoWrapper(theFunction, body, m_memoTable);
+
+	auto start = std::chrono::steady_clock::now();
+	if (intBody) TheFPM->run(*intBody);
+	if (body != theFunction) TheFPM->run(*body);
+	TheFPM->run(*theFunction); 			// optimize this function
+	FunctionPassesTime += std::chrono::steady_clock::now() - start;
+	return theFunction;
 }
 
-void InitializeModuleAndPassManager() {
+static void initializeModuleAndPassManager(unsigned optLevel) {
 	TheModule = make_unique<Module>("mah module", TheContext);
+	if (TheJIT) {
+		TheModule->setDataLayout(TheJIT->getTargetMachine().createDataLayout());
+		TheModule->setTargetTriple(TheJIT->getTargetMachine().getTargetTriple().str());
+	}
+
 	TheFPM = make_unique<legacy::FunctionPassManager>(TheModule.get());
+	// Cost models (the loop vectorizer's) need to know the target
+	if (TheJIT) TheFPM->add(createTargetTransformInfoWrapperPass(TheJIT->getTargetMachine().getTargetIRAnalysis()));
+	addFunctionPasses(*TheFPM, optLevel);
 	TheFPM->doInitialization();
 }
 
+void InitializeModuleAndPassManager() {
+	initializeModuleAndPassManager(TheOptions.optLevel);
+}
+
+
+/// Gives the inliner something to work with: every function which is only
+/// declared in TheModule, but was defined by an earlier 'def', gets its body
+/// generated again as available_externally. Such a body can be inlined,
+/// but it is never emitted (the real one lives in an older module).
+static void importCalleeBodies() {
+	bool changed = true;
+	while (changed) {
+		changed = false;
+		for (auto &f : *TheModule) {
+			if (! f.isDeclaration()) continue;
+			auto fun = findFunctionDef(Symbol::intern(f.getName()));
+			if (! fun) continue;
+
+			if (fun->codegen()) {
+				f.setLinkage(GlobalValue::AvailableExternallyLinkage);
+				// The new body may call functions we haven't seen yet
+				changed = true;
+				break;
+			}
+		}
+	}
+}
+
+static void optimizeModule(unsigned ipoLevel) {
+	if (ipoLevel >= 2) importCalleeBodies();
+
+	legacy::PassManager MPM;
+	if (TheJIT) MPM.add(createTargetTransformInfoWrapperPass(TheJIT->getTargetMachine().getTargetIRAnalysis()));
+	addModulePasses(MPM, ipoLevel);
+	MPM.run(*TheModule);
+}
+
+void OptimizeModule() {
+	auto start = std::chrono::steady_clock::now();
+	optimizeModule(TheOptions.ipoLevel);
+	auto end = std::chrono::steady_clock::now();
+
+	if (TheOptions.timePasses) {
+		typedef std::chrono::duration<double, std::milli> ms;
+		std::cerr << "; function passes (-O" << TheOptions.optLevel << "): "
+			<< ms(FunctionPassesTime).count() << " ms, module passes (-ipo="
+			<< TheOptions.ipoLevel << "): " << ms(end - start).count() << " ms" << std::endl;
+	}
+	FunctionPassesTime = std::chrono::steady_clock::duration::zero();
+}
+
+std::unique_ptr<Module> CodegenIsolated(const FunctionAST& fun, const std::string& suffix,
+		unsigned optLevel, unsigned ipoLevel, TierProfile* profile) {
+	// Whatever is being built in TheModule right now stays untouched
+	std::unique_ptr<Module> oldModule = std::move(TheModule);
+	std::unique_ptr<legacy::FunctionPassManager> oldFPM = std::move(TheFPM);
+	IRBuilderBase::InsertPointGuard guard(Builder);
+	initializeModuleAndPassManager(optLevel);
+
+	CurrentProfile = profile;
+	Function* theFunction = fun.codegen();
+	CurrentProfile = nullptr;
+
+	std::unique_ptr<Module> M;
+	if (theFunction) {
+		theFunction->setName(fun.name().str() + suffix);
+		if (profile) {
+			// Recursive calls go through the stub as well,
+			// so they pick up the optimized body as soon as it is there.
+			Function* stub = Function::Create(theFunction->getFunctionType(),
+					Function::ExternalLinkage, fun.name().str(), TheModule.get());
+			theFunction->replaceAllUsesWith(stub);
+		}
+		optimizeModule(ipoLevel);
+		M = std::move(TheModule);
+	}
+
+	TheModule = std::move(oldModule);
+	TheFPM = std::move(oldFPM);
+	return M;
+}
@@ -13,8 +13,15 @@
 #include "llvm/Transforms/Scalar.h"
 #include "llvm/Support/TargetSelect.h"
 #include "KaleidoscopeJIT.h"
+#include "arena.hpp"
+#include "flatast.hpp"
+#include "interp.hpp"
+#include "symbols.hpp"
+#include "types.hpp"
 
 #include <map>
+#include <memory>
+#include <set>
 #include <vector>
 
 #define LLVM_FP(x) ConstantFP::get(TheContext, APFloat(x))
@@ -28,44 +35,131 @@ Value* logError(std::string errMsg);
 /// Initializes the module and pass manager.
 void InitializeModuleAndPassManager();
 
+/// Runs the module (interprocedural) pipeline on TheModule.
+/// Must be called right before TheModule is handed to the JIT.
+void OptimizeModule();
+
 /// Returns the function if the function exists
 /// either as a fully define function or as a prototype only.
-Function* getFunction(std::string name);
+Function* getFunction(Symbol name);
+
+class FunctionAST;
+class PrototypeAST;
+struct TierProfile;
+class MemoTable;
+
+/// Makes a function known to later modules without generating any code.
+void addFunctionProto(const PrototypeAST& proto);
+
+/// Remembers a 'def' so later modules can inline it or recompile it.
+void addFunctionDef(std::shared_ptr<FunctionAST> fun);
+
+/// Forgets the prototype and the 'def' of 'name', later modules can't call it.
+void forgetFunction(Symbol name);
+
+/// Returns the number of arguments of the function called 'name' (-1 if
+/// there is no prototype of it). Generates no code, unlike getFunction().
+int functionArity(Symbol name);
+
+/// Returns the latest 'def' of the function called 'name' (nullptr if none).
+std::shared_ptr<FunctionAST> findFunctionDef(Symbol name);
+
+/// Generates 'fun' into a module of its own, runs the function pipeline
+/// of 'optLevel' and the module pipeline of 'ipoLevel' on it and renames
+/// the function to its name + 'suffix'. With a 'profile' the code is tier 0
+/// code: it counts calls and loop back edges (see tiering.hpp) and calls
+/// itself through the stub. TheModule is left alone.
+/// Returns nullptr if codegen failed.
+std::unique_ptr<Module> CodegenIsolated(const FunctionAST& fun, const std::string& suffix,
+		unsigned optLevel, unsigned ipoLevel, TierProfile* profile);
 
 /// Returns an address on stack for a variable called 'name'
-/// inside the function called 'TheFunction'.
-AllocaInst* CreateEntryBlockAlloca(Function* TheFunction, const std::string& name);
+/// inside the function called 'TheFunction' (of type 'type', a double if nullptr).
+AllocaInst* CreateEntryBlockAlloca(Function* TheFunction, const Twine& name, Type* type = nullptr);
 
 /// Represents an abstract node of the syntax tree (an expression)
 class ExprAST {
 public:
 	virtual ~ExprAST() {}
 	virtual Value* codegen() const = 0;
+	/// Interprets the expression, see interp.hpp.
+	virtual double eval(Interpreter& env) const = 0;
+	/// Adds the expression (and its children) to a flat AST, see flatast.hpp.
+	virtual void flatten(FlatBuilder& builder) const = 0;
+	/// Counts the nodes of the expression, to time walking the tree
+	/// against walking the flat AST (-stats).
+	virtual unsigned countNodes() const = 0;
+	/// Types the expression (and its children), see types.hpp.
+	virtual KalType inferType(TypeInference& types) const = 0;
+	/// Folds constant children in place. Returns the node replacing this
+	/// one (or this one), see FoldConstants().
+	virtual ExprAST* fold() = 0;
+	/// Adds the calls to 'name' with 'arity' arguments in tail position
+	/// (their value is the value of this expression) to 'calls'.
+	virtual void findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const {}
+	/// Adds the names of the functions called by the expression to 'callees'.
+	virtual void collectCalls(std::set<Symbol>& callees) const = 0;
+	/// Appends the structure of the expression to 'key': the same for
+	/// expressions written the same way, see exprcache.hpp.
+	virtual void appendStructure(std::string& key) const = 0;
 };
 
+/// Folds the constant parts of 'expr' (ex. '2+3' or 'if 1 then x else y')
+/// and returns the folded expression (new nodes go to TheASTArena, the
+/// ones not needed anymore stay in their arena until it is freed).
+ExprAST* FoldConstants(ExprAST* expr);
+
+/// If 'expr' is a constant, stores it in 'val' and returns true.
+bool isConstant(const ExprAST* expr, double& val);
+
+/// Folds the constant parts of 'flat' the way FoldConstants() folds a tree
+/// (the nodes are rebuilt without the folded ones).
+void FoldConstants(FlatAST& flat);
+
+/// If 'flat' is a constant, stores it in 'val' and returns true.
+bool isConstant(const FlatAST& flat, double& val);
+
 /// Represents an node that contains a constant. Ex '5.1'
+/// 'isInt' if it was written as an integer. Ex '5'
 class NumberExprAST : public ExprAST {
 public:
-	NumberExprAST(double val)
-		: m_val(val)
+	NumberExprAST(double val, bool isInt = false)
+		: m_val(val), m_isInt(isInt)
 	{}
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
+	double value() const { return m_val; }
+	bool isInt() const { return m_isInt; }
 
 private:
 	double m_val;
+	bool m_isInt;
 };
 
 /// Represents a variable name. Ex. 'x'
 class VariableExprAST : public ExprAST {
 public:
-	VariableExprAST(std::string name)
+	VariableExprAST(Symbol name)
 		: m_name(name)
 	{}
 	Value* codegen() const;
-	std::string name() const { return m_name; }
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
+	Symbol name() const { return m_name; }
 
 private:
-	std::string m_name;
+	Symbol m_name;
 };
 
 /// Represents a binary operator. Ex. 'x + 2.11'
@@ -75,6 +169,14 @@ public:
 		: m_op(op), m_left(left), m_right(right)
 	{}
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
+	void findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const;
 
 private:
 	BinaryExprAST(const BinaryExprAST&);
@@ -87,24 +189,26 @@ private:
 /// Ex. 'var x, y = 3, z = 99 in f(x, y, z)'
 class VarDefExprAST : public ExprAST {
 public:
-	VarDefExprAST(std::vector<std::pair<std::string, ExprAST*> > varDeclDefs, 
+	VarDefExprAST(std::vector<std::pair<Symbol, ExprAST*> > varDeclDefs,
 			ExprAST* innerExpr)
-		: m_varDeclDefs(varDeclDefs), m_innerExpr(innerExpr)
+		: m_varDeclDefs(std::move(varDeclDefs)), m_innerExpr(innerExpr)
 	{}
 
-	~VarDefExprAST() {
-		for (auto& ex : m_varDeclDefs)
-			delete ex.second;
-		delete m_innerExpr;
-	}
-
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
+	void findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const;
 
 private:
 	VarDefExprAST(const VarDefExprAST&) = delete;
 	VarDefExprAST& operator=(const VarDefExprAST&) = delete;
 
-	std::vector<std::pair<std::string, ExprAST*> > m_varDeclDefs;
+	std::vector<std::pair<Symbol, ExprAST*> > m_varDeclDefs;
 	ExprAST* m_innerExpr;
 };
 
@@ -115,12 +219,15 @@ public:
 		: m_cond(cond), m_thenExpr(thenExpr), m_elseExpr(elseExpr)
 	{}
 
-	~IfThenElseExprAST() {
-		delete m_cond;
-		delete m_thenExpr;
-		delete m_elseExpr;
-	}
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
+	void findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const;
 
 private:
 	IfThenElseExprAST(const IfThenElseExprAST&) = delete;
@@ -134,19 +241,20 @@ private:
 /// Represents a for loop statement (expression). Ex. 'for i = 1, i < 10, 1.0 in sin(i)'
 class ForExprAST : public ExprAST {
 public:
-	ForExprAST (std::string varName, ExprAST* init, ExprAST* cond, ExprAST* step, ExprAST* body)
+	ForExprAST (Symbol varName, ExprAST* init, ExprAST* cond, ExprAST* step, ExprAST* body)
 		: m_varName(varName), m_init(init), m_cond(cond), m_step(step), m_body(body)
 	{}
-	~ForExprAST () {
-		delete m_init;
-		delete m_cond;
-		delete m_step;
-		delete m_body;
-	}
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
 
 private:
-	std::string m_varName;
+	Symbol m_varName;
 	ExprAST* m_init;
 	ExprAST* m_cond;
 	ExprAST* m_step;
@@ -160,6 +268,13 @@ public:
 	{}
 
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
 
 private:
 	ExprAST* m_cond;
@@ -169,18 +284,23 @@ private:
 /// Represents a function call statement (expression). Ex. 'sin(3.14)'
 class CallExprAST : public ExprAST {
 public:
-	CallExprAST(std::string name, std::vector<ExprAST*> exps)
-		: m_name(name), m_exps(exps)
+	CallExprAST(Symbol name, std::vector<ExprAST*> exps)
+		: m_name(name), m_exps(std::move(exps))
 	{}
-	~CallExprAST() {
-		for (auto e : m_exps) delete e;
-	}
 	Value* codegen() const;
+	double eval(Interpreter& env) const;
+	void flatten(FlatBuilder& builder) const;
+	unsigned countNodes() const;
+	KalType inferType(TypeInference& types) const;
+	ExprAST* fold();
+	void collectCalls(std::set<Symbol>& callees) const;
+	void appendStructure(std::string& key) const;
+	void findTailCalls(Symbol name, size_t arity, std::set<const ExprAST*>& calls) const;
 
 private:
 	CallExprAST(CallExprAST&);
 	CallExprAST& operator=(const CallExprAST&);
-	std::string m_name;
+	Symbol m_name;
 	std::vector<ExprAST*> m_exps;
 };
 
@@ -189,36 +309,56 @@ private:
 /// Ex. 'extern sin(x)'
 class PrototypeAST {
 public:
-	PrototypeAST(std::string name, std::vector<std::string> args)
-		: m_name(name), m_args(args)
+	/// Qualifiers between 'def' and the name. Ex. 'def fast f(x)'
+	enum Qualifier {
+		/// Floating point math may be reassociated (fast-math flags)
+		Fast = 1 << 0,
+		/// Results are cached, see memo.hpp
+		Memo = 1 << 1
+	};
+
+	PrototypeAST(Symbol name, std::vector<Symbol> args, unsigned qualifiers = 0)
+		: m_name(name), m_args(std::move(args)), m_qualifiers(qualifiers)
 	{}
 
-	std::string name() const { return m_name; }
+	Symbol name() const { return m_name; }
+	const std::vector<Symbol>& args() const { return m_args; }
+	bool isFast() const { return m_qualifiers & Fast; }
+	bool isMemo() const { return m_qualifiers & Memo; }
+	void setQualifiers(unsigned qualifiers) { m_qualifiers = qualifiers; }
 	Function* codegen() const;
 
 private:
-	std::string m_name;
-	std::vector<std::string> m_args;
+	Symbol m_name;
+	std::vector<Symbol> m_args;
+	unsigned m_qualifiers;
 };
 
 /// Represents a fully defined function with a prototype and definition.
 /// Ex. 'def f(x) x*x'
+/// The definition lives in 'arena', which the function keeps alive.
 class FunctionAST {
 public:
-	FunctionAST(PrototypeAST proto, ExprAST* definition)
-		: m_proto(proto), m_definition(definition)
+	FunctionAST(PrototypeAST proto, ExprAST* definition, std::shared_ptr<ASTArena> arena)
+		: m_proto(std::move(proto)), m_definition(definition), m_arena(std::move(arena)), m_memoTable(nullptr)
 	{}
 
-	~FunctionAST() {
-		delete m_definition;
-	}
+	Symbol name() const { return m_proto.name(); }
+	const PrototypeAST& proto() const { return m_proto; }
+	const ExprAST* body() const { return m_definition; }
+	/// Memoizes the function in 'table' (see memo.hpp).
+	void setMemoTable(MemoTable* table) { m_memoTable = table; }
 	Function* codegen() const;
 
 private:
+	bool codegenBody(Function* theFunction, const TypeInference* types) const;
+
 	FunctionAST(const FunctionAST&);
 	FunctionAST& operator=(const FunctionAST&);
 	PrototypeAST m_proto;
 	ExprAST* m_definition;
+	std::shared_ptr<ASTArena> m_arena;
+	MemoTable* m_memoTable;
 };
 
 #endif /* ifndef AST_HPP */
@@ -0,0 +1,13 @@
+#!/bin/sh
+# Prints N (default 10000) definitions with loops, variables and calls,
+# each followed by a top-level expression calling it, for parsing benchmarks.
+n=${1:-10000}
+
+awk -v n="$n" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		if (i > 0) printf ";\n"
+		printf "def f%d(x y) var s = 0, t = x in ((for i = 0, i < y, 1.0 in s = s + t * i - %d): if s > 100 then f%d(s - 1, y) else s + x * (y - 2.5));\n", i, i, i
+		printf "f%d(%d, 10)", i, i
+	}
+	printf "\n"
+}'
@@ -0,0 +1,11 @@
+#!/bin/sh
+# Prints a definition followed by N (default 100000) top-level expressions
+# calling it, every one of them a module of its own in the JIT.
+n=${1:-100000}
+
+awk -v n="$n" 'BEGIN {
+	printf "def f(x) x * 2 + 1"
+	for (i = 0; i < n; i++)
+		printf ";\nf(%d)", i
+	printf "\n"
+}'
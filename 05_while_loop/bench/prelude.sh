@@ -0,0 +1,12 @@
+#!/bin/sh
+# Prints a prelude of N (default 2000) small definitions followed by a
+# single expression that calls just one of them.
+n=${1:-2000}
+
+awk -v n="$n" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		printf "def f%d(x y)\n", i
+		printf "var s in\n(\n\t(for i = 0, i < x, 1.0 in s = s + i * y + %d):\n\ts\n);\n\n", i
+	}
+	printf "f%d(10, 2)\n", n / 2
+}'
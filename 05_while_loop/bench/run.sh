@@ -0,0 +1,150 @@
+#!/bin/sh
+# Runs bench/fib.kal at every optimization level and prints how long
+# each top-level expression took (fib(32), then 10^6 calls of fibi(60)).
+# The same with tiered compilation (-O0 first, hot functions at -O3),
+# and both with SSA built during codegen (-ssa), and with -infer-types,
+# and deep tail recursion of bench/tailrec.kal.
+# Then runs bench/inline.kal at -O2 with every module pipeline level
+# and compares eager, background (-jobs) and lazy startup on a generated
+# prelude, and cold and warm startup with the object cache.
+# Then reductions of bench/reduce.kal at -O3, plain and with fast-math.
+# Then the exponential recursion of bench/memo.kal with and without -memo.
+# Then how long looking up (and linking) an expression takes in the
+# first and the last 1000 of 100000 expressions (bench/exprs.sh), and
+# resident and JIT memory along 1000000 expressions, and the time of
+# 100000 expressions with and without -batch, and repeated probes of
+# bench/probes.kal with and without -expr-cache, and one-shot calls of
+# bench/oneshot.kal compiled and interpreted, and the loops of
+# bench/interp.kal interpreted over the flat AST and the syntax tree.
+# Then parsing alone (-parse-only) of 10000 and 100000 generated
+# definitions (bench/ast.sh), with the arena allocations and interned
+# identifiers it takes.
+# Then codegen of definitions nesting 200 and 2000 'var'/'for' scopes
+# (bench/scopes.sh), with allocas and with -ssa.
+# Last, lexing throughput (-lex-only) of 3 and 16 MB of generated
+# definitions, mapped from the file and read from a pipe.
+cd "$(dirname "$0")/.." || exit 1
+
+# Wall time of a command in ms
+elapsed() {
+	start=$(date +%s%N)
+	"$@" > /dev/null 2>&1
+	end=$(date +%s%N)
+	echo "$(( (end - start) / 1000000 )) ms"
+}
+
+for level in 0 1 2 3; do
+	echo "== fib.kal -O$level"
+	./kaleidoscope -q -time -O$level bench/fib.kal 2>&1 | grep -v '^$'
+done
+
+echo "== fib.kal -tiered"
+./kaleidoscope -q -time -tiered bench/fib.kal 2>&1 | grep -v '^$'
+
+# SSA construction during codegen: no allocas even without any passes
+echo "== fib.kal -O0 -ssa"
+./kaleidoscope -q -time -O0 -ssa bench/fib.kal 2>&1 | grep -v '^$'
+echo "== fib.kal -tiered -ssa"
+./kaleidoscope -q -time -tiered -ssa bench/fib.kal 2>&1 | grep -v '^$'
+# Integers and booleans as i64 and i1 instead of doubles
+for level in 0 2; do
+	echo "== fib.kal -O$level -infer-types"
+	./kaleidoscope -q -time -O$level -infer-types bench/fib.kal 2>&1 | grep -v '^$'
+done
+
+# Deep tail recursion (would overflow the stack as plain calls)
+for level in 0 2; do
+	echo "== tailrec.kal -O$level"
+	./kaleidoscope -q -time -O$level bench/tailrec.kal 2>&1 | grep -v '^$'
+done
+
+echo "== IR lines of fib.kal -O0, allocas vs -ssa"
+echo "allocas: $(./kaleidoscope -O0 bench/fib.kal 2>&1 | grep -c '^ ')"
+echo "ssa:     $(./kaleidoscope -O0 -ssa bench/fib.kal 2>&1 | grep -c '^ ')"
+
+for level in 0 1 2 3; do
+	echo "== inline.kal -O2 -ipo=$level"
+	./kaleidoscope -q -time -time-passes -O2 -ipo=$level bench/inline.kal 2>&1 | grep -v '^$'
+done
+
+prelude=${TMPDIR:-/tmp}/kal_prelude.kal
+sh bench/prelude.sh 2000 > "$prelude"
+echo "== 2000 definitions, one call -O2"
+echo "eager: $(elapsed ./kaleidoscope -q -O2 "$prelude")"
+echo "eager, -jobs=4: $(elapsed ./kaleidoscope -q -O2 -jobs=4 "$prelude")"
+echo "lazy:  $(elapsed ./kaleidoscope -q -O2 -lazy "$prelude")"
+
+cache=${TMPDIR:-/tmp}/kal_objcache
+rm -rf "$cache"
+echo "== 2000 definitions, -O2 -cache-dir"
+echo "cold: $(elapsed ./kaleidoscope -q -O2 -cache-dir="$cache" "$prelude")"
+echo "warm: $(elapsed ./kaleidoscope -q -O2 -cache-dir="$cache" "$prelude")"
+./kaleidoscope -q -O2 -cache-dir="$cache" -stats "$prelude" 2>&1 | grep objcache
+rm -rf "$cache" "$prelude"
+
+echo "== reduce.kal -O3 (sum, fast sum, poly, fast poly)"
+./kaleidoscope -q -time -O3 bench/reduce.kal 2>&1 | grep -v '^$'
+echo "== reduce.kal -O3 -ffast-math"
+./kaleidoscope -q -time -O3 -ffast-math bench/reduce.kal 2>&1 | grep -v '^$'
+
+echo "== memo.kal -O2"
+./kaleidoscope -q -time -O2 bench/memo.kal 2>&1 | grep -v '^$'
+echo "== memo.kal -O2 -memo"
+./kaleidoscope -q -time -O2 -memo -stats bench/memo.kal 2>&1 | grep -v '^$'
+
+exprs=${TMPDIR:-/tmp}/kal_exprs.kal
+sh bench/exprs.sh 100000 > "$exprs"
+echo "== 100000 top-level expressions, average lookup"
+./kaleidoscope -q -time "$exprs" 2>&1 | awk -v n=100000 '
+	/^; looked up in/ { i++; if (i <= 1000) first += $5; if (i > n - 1000) last += $5 }
+	END { printf "first 1000: %.1f us, last 1000: %.1f us\n", first, last }'
+for batch in 1 100 1000; do
+	echo "100000 expressions -batch=$batch: $(elapsed ./kaleidoscope -q -batch=$batch "$exprs")"
+done
+
+sh bench/exprs.sh 1000000 > "$exprs"
+echo "== 1000000 top-level expressions, memory every 100000"
+./kaleidoscope -q -mem "$exprs" 2>&1 | awk '/^; memory:/ { if (++i % 100000 == 0) print i ": " substr($0, 3) }'
+rm -f "$exprs"
+
+echo "== probes.kal"
+echo "no cache:       $(elapsed ./kaleidoscope -q bench/probes.kal)"
+echo "-expr-cache=16: $(elapsed ./kaleidoscope -q -expr-cache=16 bench/probes.kal)"
+
+echo "== oneshot.kal"
+echo "compiled:    $(elapsed ./kaleidoscope -q bench/oneshot.kal)"
+echo "interpreted: $(elapsed ./kaleidoscope -q -interp bench/oneshot.kal)"
+./kaleidoscope -q -interp -stats bench/oneshot.kal 2>&1 | grep interp
+
+for ast in flat tree; do
+	echo "== interp.kal -interp=always -interp-ast=$ast"
+	./kaleidoscope -q -time -interp=always -interp-ast=$ast bench/interp.kal 2>&1 | grep -v '^$'
+done
+# Bytes per node and walking time of the flat AST against the ExprAST objects
+./kaleidoscope -q -interp=always -stats bench/interp.kal 2>&1 | grep flat
+
+ast=${TMPDIR:-/tmp}/kal_ast.kal
+for n in 10000 100000; do
+	sh bench/ast.sh $n > "$ast"
+	echo "== parse $n definitions ($(wc -c < "$ast") bytes) -parse-only: $(elapsed ./kaleidoscope -q -parse-only "$ast")"
+	./kaleidoscope -q -parse-only -stats "$ast" 2>&1 | grep 'arena\|symbols'
+done
+rm -f "$ast"
+
+scopes=${TMPDIR:-/tmp}/kal_scopes.kal
+for depth in 200 2000; do
+	sh bench/scopes.sh $((200000 / depth)) $depth > "$scopes"
+	echo "== $((200000 / depth)) definitions $depth scopes deep -O0"
+	echo "allocas: $(elapsed ./kaleidoscope -q -O0 "$scopes")"
+	echo "ssa:     $(elapsed ./kaleidoscope -q -O0 -ssa "$scopes")"
+done
+rm -f "$scopes"
+
+src=${TMPDIR:-/tmp}/kal_lex.kal
+for n in 20000 100000; do
+	sh bench/ast.sh $n > "$src"
+	echo "== lex $(wc -c < "$src") bytes -lex-only"
+	./kaleidoscope -q -lex-only -stats "$src" 2>&1 | grep 'lexed\|source'
+	echo "pipe: $(cat "$src" | ./kaleidoscope -q -lex-only 2>&1 | grep lexed)"
+done
+rm -f "$src"
@@ -0,0 +1,20 @@
+#!/bin/sh
+# Prints N (default 1000) definitions nesting D (default 200) scopes each,
+# alternating 'var' and 'for' and shadowing the same few names all the way
+# down, for codegen benchmarks.
+n=${1:-1000}
+d=${2:-200}
+
+awk -v n="$n" -v d="$d" 'BEGIN {
+	for (i = 0; i < n; i++) {
+		if (i > 0) printf ";\n"
+		printf "def s%d(x)", i
+		for (l = 0; l < d; l++) {
+			if (l % 2 == 0) printf " var x = x + 1, y = x, x = x * y in ("
+			else printf " (for i = 0, i < 2, 1.0 in x = x + i + y): ("
+		}
+		printf "x + y"
+		for (l = 0; l < d; l++) printf ")"
+	}
+	printf "\n"
+}'
@@ -0,0 +1,410 @@
+#include "driver.hpp"
+#include "ast.hpp"
+#include "aot.hpp"
+#include "exprcache.hpp"
+#include "flatast.hpp"
+#include "interp.hpp"
+#include "memo.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+#include "tiering.hpp"
+#include "workers.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <fstream>
+#include <unistd.h>
+
+extern thread_local std::unique_ptr<Module> TheModule;
+extern std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
+
+static Statistic NumConstantExprs("driver", "top-level expressions folded to a constant (no JIT)");
+static Statistic NumMemoized("driver", "functions memoized");
+static Statistic NumCodeReused("exprcache", "repeated expressions run without compiling");
+static Statistic NumResultsReused("exprcache", "repeated pure expressions not run at all");
+static Statistic NumInterpreted("interp", "top-level expressions interpreted instead of compiled");
+static Statistic NumCompileMicrosSaved("interp", "microseconds of compiling saved (by the average compile time)");
+static Statistic NumExprsBatched("driver", "top-level expressions compiled in a batch with others");
+
+/// Returns true if 'M' has a function with a body.
+static bool hasDefinitions(const Module& M) {
+	for (auto& F : M)
+		if (! F.isDeclaration()) return true;
+	return false;
+}
+
+/// Resident set size of the process in KiB (0 if unknown).
+static unsigned long residentKiB() {
+	std::ifstream statm("/proc/self/statm");
+	unsigned long size = 0, resident = 0;
+	if (! (statm >> size >> resident)) return 0;
+	return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+/// A top-level expression waiting to run: a constant 'value', a function
+/// of TheModule called 'name', (with -expr-cache) a 'cached' one, or
+/// (with -interp) one to be 'interpreted'.
+/// Without -batch only one ever waits.
+struct PendingExpr {
+	bool isConstant;
+	double value;
+	std::string name;
+	/// The entry to fill in once it ran, or to take it from if 'name' is empty
+	std::shared_ptr<CachedExpr> cached;
+	/// The expression if it is interpreted instead (-interp): flattened,
+	/// or the syntax tree itself with -interp-ast=tree
+	std::shared_ptr<FlatAST> flat;
+	std::shared_ptr<ExprAST> interpreted;
+};
+static std::vector<PendingExpr> PendingExprs;
+
+/// Returns true if TheModule holds pending expressions.
+static bool hasCompiledExprs() {
+	for (auto& pending : PendingExprs)
+		if (! pending.name.empty()) return true;
+	return false;
+}
+
+static void printValue(double value) {
+	std::cout << "Expression value: " << value << std::endl;
+}
+
+/// Time spent compiling top-level expressions (codegen, module pipeline,
+/// JIT), to tell what the interpreter saves
+static std::chrono::steady_clock::duration ExprCompileTime;
+static unsigned NumExprsCompiled = 0;
+
+/// Returns how long compiling an expression took on average (0 if none was).
+static std::chrono::duration<double, std::milli> averageCompileTime() {
+	if (NumExprsCompiled == 0) return std::chrono::duration<double, std::milli>::zero();
+	return std::chrono::duration<double, std::milli>(ExprCompileTime) / NumExprsCompiled;
+}
+
+/// -interp: returns true if interpreting the expression 'flat' (nullptr if
+/// it has no flat AST) is cheaper than compiling it.
+static bool shouldInterpret(const FlatAST* flat) {
+	// The interpreter knows doubles only, what doesn't flatten gets
+	// compiled, which reports the error
+	if (! TheOptions.interp || ! flat) return false;
+	EvalCost cost = flat->cost();
+	if (cost.maxArgs > MaxEvalArgs) return false;
+	// Every iteration of a loop walks the nodes again, calls run JITed code
+	return TheOptions.interpAlways || cost.loops == 0;
+}
+
+/// Returns the folded flat AST of 'expr' (nullptr if it doesn't flatten).
+static std::shared_ptr<FlatAST> flattenAndFold(const ExprAST& expr) {
+	auto flat = std::make_shared<FlatAST>();
+	if (! flattenExpression(expr, *flat)) return nullptr;
+	FoldConstants(*flat);
+	return flat;
+}
+
+/// Interprets the expression of 'pending' and prints its value.
+static void interpretExpression(const PendingExpr& pending) {
+	double value;
+	bool failed;
+	auto start = std::chrono::steady_clock::now();
+	if (pending.flat) {
+		FlatInterpreter interpreter(*pending.flat);
+		value = interpreter.run();
+		failed = interpreter.failed();
+	} else {
+		Interpreter env;
+		value = pending.interpreted->eval(env);
+		failed = env.failed();
+	}
+	std::chrono::duration<double, std::milli> took = std::chrono::steady_clock::now() - start;
+	if (failed) return;
+
+	++NumInterpreted;
+	printValue(value);
+	auto compile = averageCompileTime();
+	if (compile > took) NumCompileMicrosSaved += (uint64_t)((compile - took).count() * 1000);
+	if (TheOptions.time) {
+		std::cerr << "; interpreted in " << took.count() << " ms";
+		if (NumExprsCompiled) std::cerr << ", compiling takes " << compile.count() << " ms on average";
+		std::cerr << std::endl;
+	}
+}
+
+/// Looks up the compiled expression 'name' in the JIT.
+static ExprFunction lookupExpression(const std::string& name) {
+	// We search the JIT for the expression's symbol, get its address and
+	// cast it to the right type (takes no arguments, returns a double)
+	// so we can call it as a native function.
+	// Linking the module looks up what it calls as well
+	auto start = std::chrono::steady_clock::now();
+	ExprFunction FP = (ExprFunction)TheJIT->getSymbolAddress(name);
+	auto end = std::chrono::steady_clock::now();
+	ExprCompileTime += end - start;
+	if (TheOptions.time)
+		std::cerr << "; looked up in "
+			<< std::chrono::duration<double, std::milli>(end - start).count()
+			<< " ms" << std::endl;
+	return FP;
+}
+
+/// Runs a compiled expression, prints its value and returns it.
+static double runExpression(ExprFunction FP) {
+	auto start = std::chrono::steady_clock::now();
+	double value = FP();
+	auto end = std::chrono::steady_clock::now();
+	printValue(value);
+	if (TheOptions.time)
+		std::cerr << "; executed in "
+			<< std::chrono::duration<double, std::milli>(end - start).count()
+			<< " ms" << std::endl;
+	return value;
+}
+
+/// Runs 'pending', filling in its cache entry, if any.
+static void runPendingExpr(const PendingExpr& pending, const std::shared_ptr<ExprModule>& module) {
+	if (pending.isConstant) {
+		printValue(pending.value);
+		if (TheOptions.time) std::cerr << "; folded to a constant, not compiled" << std::endl;
+		return;
+	}
+	if (pending.flat || pending.interpreted) {
+		interpretExpression(pending);
+		return;
+	}
+
+	CachedExpr* cached = pending.cached.get();
+	if (pending.name.empty() && cached->hasResult) {
+		++NumResultsReused;
+		printValue(cached->result);
+		if (TheOptions.time) std::cerr << "; cached result, not run" << std::endl;
+		return;
+	}
+
+	ExprFunction FP;
+	if (pending.name.empty()) {
+		++NumCodeReused;
+		if (TheOptions.time) std::cerr << "; cached, not compiled" << std::endl;
+		FP = cached->function;
+	} else {
+		FP = lookupExpression(pending.name);
+		if (cached) {
+			cached->function = FP;
+			cached->module = module;
+		}
+	}
+	if (! FP) {
+		logError("Top-level expression not run, its code isn't in the JIT");
+		return;
+	}
+
+	double value = runExpression(FP);
+	if (cached && cached->pure) {
+		cached->hasResult = true;
+		cached->result = value;
+	}
+}
+
+/// Waits for the definitions compiled in the background. If some failed,
+/// drops the compiled expressions if they call one of them.
+static void waitForDefinitions() {
+	std::vector<Symbol> failed = waitForWorkers();
+	bool callsFailed = false;
+	for (auto name : failed) {
+		// Cached expressions calling it are keyed on the failed version
+		newFunctionVersion(name);
+		if (TheModule->getFunction(name.str())) callsFailed = true;
+	}
+	if (! callsFailed || ! hasCompiledExprs()) return;
+
+	logError("Top-level expressions not run, they call a function that failed to compile");
+	// Repeats of them in the batch would run their code, which never comes
+	std::set<const CachedExpr*> dropped;
+	for (auto& pending : PendingExprs)
+		if (! pending.name.empty() && pending.cached) dropped.insert(pending.cached.get());
+	PendingExprs.erase(std::remove_if(PendingExprs.begin(), PendingExprs.end(),
+		[&dropped](const PendingExpr& pending) {
+			return ! pending.name.empty() || dropped.count(pending.cached.get());
+		}), PendingExprs.end());
+	forgetCachedExprs(dropped);
+	InitializeModuleAndPassManager();
+}
+
+/// Compiles the pending expressions in one module, runs them in order
+/// and frees the module (unless cached expressions live in it).
+static void flushExpressions() {
+	if (PendingExprs.empty()) return;
+	// The expressions may call definitions still being compiled
+	waitForDefinitions();
+
+	unsigned numCompiled = 0;
+	for (auto& pending : PendingExprs)
+		if (! pending.name.empty()) ++numCompiled;
+	if (numCompiled > 1) NumExprsBatched += numCompiled;
+
+	std::shared_ptr<ExprModule> module;
+	if (numCompiled > 0) {
+		auto start = std::chrono::steady_clock::now();
+		OptimizeModule();
+		module = std::make_shared<ExprModule>(TheJIT->addModule(std::move(TheModule)));
+		InitializeModuleAndPassManager();
+		ExprCompileTime += std::chrono::steady_clock::now() - start;
+		NumExprsCompiled += numCompiled;
+	}
+
+	for (auto& pending : PendingExprs)
+		runPendingExpr(pending, module);
+	PendingExprs.clear();
+	module.reset();
+
+	if (TheOptions.memReport)
+		std::cerr << "; memory: " << residentKiB() << " KiB resident, "
+			<< TheJIT->getAllocatedBytes() / 1024 << " KiB in "
+			<< TheJIT->getNumModules() << " JIT modules" << std::endl;
+}
+
+/// Queues 'pending', running the batch if it is full.
+static void addPendingExpr(const PendingExpr& pending) {
+	PendingExprs.push_back(pending);
+	if (PendingExprs.size() >= std::max(TheOptions.batch, 1u)) flushExpressions();
+}
+
+/// Gives 'fun' a result cache if it is 'def memo' (or -memo and recursive)
+/// and pure, see memo.hpp.
+static void memoize(FunctionAST& fun) {
+	Symbol impureCallee;
+	bool pure = checkPurity(fun, impureCallee);
+
+	std::set<Symbol> callees;
+	fun.body()->collectCalls(callees);
+	bool recursive = callees.count(fun.name()) > 0;
+	if (! fun.proto().isMemo() && ! (TheOptions.memo && recursive)) return;
+
+	if (! pure) {
+		if (fun.proto().isMemo())
+			std::cerr << "; '" << fun.name() << "' calls '" << impureCallee << "' which isn't pure, not memoized" << std::endl;
+		return;
+	}
+	// Nothing to key on
+	if (fun.proto().args().empty()) return;
+	// The cache lives in this process
+	if (! TheOptions.aotBase.empty()) {
+		std::cerr << "; -aot doesn't memoize '" << fun.name() << "'" << std::endl;
+		return;
+	}
+
+	++NumMemoized;
+	fun.setMemoTable(newMemoTable(fun.name().str(), fun.proto().args().size()));
+}
+
+void HandleDefinition(PrototypeAST* proto, ExprAST* body) {
+	if (TheOptions.parseOnly) return;
+	// Expressions before the definition run before it
+	flushExpressions();
+	newFunctionVersion(proto->name());
+	std::shared_ptr<FunctionAST> fun(new FunctionAST(std::move(*proto), FoldConstants(body), TheASTArena));
+	memoize(*fun);
+
+	bool ok = false;
+	if (TheOptions.jobs > 0 && ! TheOptions.lazy) {
+		// Callers only need the prototype, the body gets compiled meanwhile
+		addFunctionProto(fun->proto());
+		compileInBackground(fun);
+		ok = true;
+	} else if (TheOptions.lazy) {
+		ok = addLazyFunction(fun);
+	} else if (TheOptions.tiered) {
+		ok = addTieredFunction(fun, newStubGeneration(fun->name()));
+	} else if (auto tmp = fun->codegen()) {
+		if (! TheOptions.quiet) tmp->dump();
+		ok = true;
+	}
+	// Keep the definition around, the module pipeline may inline it later
+	if (ok) addFunctionDef(fun);
+}
+
+void HandleExtern(PrototypeAST* proto) {
+	if (TheOptions.parseOnly) return;
+	flushExpressions();
+	auto tmp = proto->codegen();
+	if (! TheOptions.quiet) tmp->dump();
+}
+
+void HandleTopLevelExpression(ExprAST* expr) {
+	if (TheOptions.parseOnly) return;
+	if (! TheOptions.aotBase.empty()) {
+		std::cerr << "; top-level expression ignored by -aot" << std::endl;
+		return;
+	}
+
+	// For -interp and -expr-cache (without types) the expression is folded,
+	// keyed and interpreted as a flat AST; the tree is folded for codegen
+	// only if it gets compiled
+	std::shared_ptr<FlatAST> flat;
+	if (! TheOptions.inferTypes && (TheOptions.interp || TheOptions.exprCache > 0))
+		flat = flattenAndFold(*expr);
+	if (! flat) expr = FoldConstants(expr);
+
+	// A constant needs no code at all
+	double value;
+	if (flat ? isConstant(*flat, value) : isConstant(expr, value)) {
+		++NumConstantExprs;
+		addPendingExpr(PendingExpr{true, value, "", nullptr});
+		return;
+	}
+
+	// Neither does an expression we have seen before
+	std::string key;
+	if (TheOptions.exprCache > 0) {
+		key = flat ? exprCacheKey(*flat) : exprCacheKey(*expr);
+		if (auto cached = findCachedExpr(key)) {
+			addPendingExpr(PendingExpr{false, 0.0, "", cached});
+			return;
+		}
+	}
+
+	// Definitions go to the JIT for good, the expressions get a module
+	// of their own which is freed once they ran
+	if (! hasCompiledExprs() && hasDefinitions(*TheModule)) {
+		OptimizeModule();
+		TheJIT->addModule(std::move(TheModule));
+		InitializeModuleAndPassManager();
+	}
+
+	// Or they aren't compiled at all
+	if (shouldInterpret(flat.get())) {
+		// The flat AST doesn't need the syntax tree, the tree interpreter
+		// keeps its arena until it ran
+		if (TheOptions.interpTree)
+			addPendingExpr(PendingExpr{false, 0.0, "", nullptr, nullptr, std::shared_ptr<ExprAST>(TheASTArena, expr)});
+		else
+			addPendingExpr(PendingExpr{false, 0.0, "", nullptr, flat, nullptr});
+		return;
+	}
+
+	// We evaluate expression by mapping it to an anonymous function and invoking JIT on it
+	// (numbered with -batch, as the module holds several of them)
+	std::string name = "__anon_expr";
+	if (TheOptions.batch > 1) name += std::to_string(PendingExprs.size());
+	if (flat) expr = FoldConstants(expr);
+	bool pure = TheOptions.exprCache > 0 && isPureExpression(*expr);
+	PrototypeAST proto(Symbol::intern(name), std::vector<Symbol>());
+	FunctionAST anonExpr(proto, expr, TheASTArena);
+	auto start = std::chrono::steady_clock::now();
+	auto tmp = anonExpr.codegen();
+	ExprCompileTime += std::chrono::steady_clock::now() - start;
+	if (! tmp) return;
+
+	if (! TheOptions.quiet) tmp->dump();
+	std::shared_ptr<CachedExpr> cached;
+	if (TheOptions.exprCache > 0) cached = addCachedExpr(key, pure);
+	addPendingExpr(PendingExpr{false, 0.0, name, cached});
+}
+
+int HandleEnd() {
+	flushExpressions();
+	clearExprCache();
+	// Take a dump :D
+	waitForWorkers();
+	if (! TheOptions.quiet) TheModule->dump();
+	if (! TheOptions.aotBase.empty() && ! emitAOT(TheOptions.aotBase)) return EXIT_FAILURE;
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,27 @@
+#ifndef DRIVER_HPP
+#define DRIVER_HPP
+
+class ExprAST;
+class PrototypeAST;
+
+/// What the parser does with every top-level command.
+/// What they get lives in TheASTArena (see arena.hpp), which the parser
+/// replaces after every command: a handler keeping any of it keeps the arena.
+
+/// 'def': folds the constants of the body and compiles the function
+/// (how, depends on the options).
+void HandleDefinition(PrototypeAST* proto, ExprAST* body);
+
+/// 'extern': declares the function.
+void HandleExtern(PrototypeAST* proto);
+
+/// A top-level expression: compiles it into __anon_expr and runs it
+/// (just prints it if it folds to a constant). With -batch it waits for
+/// more expressions to be compiled with, until the batch is full or
+/// another command comes.
+void HandleTopLevelExpression(ExprAST* expr);
+
+/// 'end' or the end of input. Returns the exit code of the program.
+int HandleEnd();
+
+#endif /* ifndef DRIVER_HPP */
@@ -0,0 +1,198 @@
+#include "exprcache.hpp"
+#include "ast.hpp"
+#include "flatast.hpp"
+#include "memo.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+
+#include <cstring>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+
+extern std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
+
+static Statistic NumModulesFreed("exprcache", "top-level expression modules freed");
+static Statistic NumEvicted("exprcache", "cached expressions evicted");
+
+// Only the parser thread handles top-level commands, no locking needed
+static std::unordered_map<std::string, std::shared_ptr<CachedExpr> > ExprCache;
+/// Keys of ExprCache, oldest first
+static std::deque<std::string> ExprCacheOrder;
+static std::unordered_map<Symbol, unsigned> FunctionVersions;
+
+/// Appends the id of 'sym' to 'key' (4 bytes, so no separator is needed).
+static void appendSymbol(std::string& key, Symbol sym) {
+	uint32_t id = sym.id();
+	key.append(reinterpret_cast<const char*>(&id), sizeof(id));
+}
+
+ExprModule::~ExprModule() {
+	TheJIT->removeModule(m_handle);
+	++NumModulesFreed;
+}
+
+/// Appends the version of every function in 'callees', and of every one
+/// they reach, to 'key'.
+static void appendCalleeVersions(std::string& key, std::set<Symbol> callees) {
+	// A redefinition of anything reachable changes what it computes, even
+	// through a function that stays the same (-lazy and -tiered repoint
+	// the stubs its code calls)
+	std::vector<Symbol> unvisited(callees.begin(), callees.end());
+	while (! unvisited.empty()) {
+		std::shared_ptr<FunctionAST> def = findFunctionDef(unvisited.back());
+		unvisited.pop_back();
+		if (! def) continue;
+		std::set<Symbol> calls;
+		def->body()->collectCalls(calls);
+		for (auto call : calls)
+			if (callees.insert(call).second) unvisited.push_back(call);
+	}
+	for (auto callee : callees) {
+		auto found = FunctionVersions.find(callee);
+		key += '|';
+		appendSymbol(key, callee);
+		key += std::to_string(found == FunctionVersions.end() ? 0 : found->second);
+	}
+}
+
+std::string exprCacheKey(const ExprAST& expr) {
+	std::string key;
+	expr.appendStructure(key);
+
+	std::set<Symbol> callees;
+	expr.collectCalls(callees);
+	appendCalleeVersions(key, callees);
+	return key;
+}
+
+std::string exprCacheKey(const FlatAST& flat) {
+	// Its own prefix, so no tree key looks like it
+	std::string key = "flat";
+	std::set<Symbol> callees;
+	for (const FlatNode& node : flat.nodes) {
+		// Slots are numbered in order, so the same expression gets the same
+		// ones. Numbers and callees go in by value, not by their index.
+		uint32_t operand = node.operand;
+		if (node.tag == FlatNumber) {
+			char bits[sizeof(double)];
+			std::memcpy(bits, &flat.numbers[operand], sizeof(bits));
+			key.append(bits, sizeof(bits));
+		} else if (node.tag == FlatCall) {
+			callees.insert(flat.callees[operand]);
+			operand = flat.callees[operand].id();
+		}
+		key += (char)node.tag;
+		key += node.op;
+		key.append(reinterpret_cast<const char*>(&node.count), sizeof(node.count));
+		key.append(reinterpret_cast<const char*>(&operand), sizeof(operand));
+	}
+	// Only the calls left after folding count
+	appendCalleeVersions(key, callees);
+	return key;
+}
+
+std::shared_ptr<CachedExpr> findCachedExpr(const std::string& key) {
+	auto found = ExprCache.find(key);
+	return found == ExprCache.end() ? nullptr : found->second;
+}
+
+std::shared_ptr<CachedExpr> addCachedExpr(const std::string& key, bool pure) {
+	while (! ExprCacheOrder.empty() && ExprCache.size() >= TheOptions.exprCache) {
+		// An expression still waiting to run keeps its entry (and module) alive
+		ExprCache.erase(ExprCacheOrder.front());
+		ExprCacheOrder.pop_front();
+		++NumEvicted;
+	}
+
+	std::shared_ptr<CachedExpr> cached = std::make_shared<CachedExpr>(pure);
+	ExprCache[key] = cached;
+	ExprCacheOrder.push_back(key);
+	return cached;
+}
+
+void forgetCachedExprs(const std::set<const CachedExpr*>& entries) {
+	for (auto it = ExprCacheOrder.begin(); it != ExprCacheOrder.end(); ) {
+		auto found = ExprCache.find(*it);
+		if (found != ExprCache.end() && entries.count(found->second.get())) {
+			ExprCache.erase(found);
+			it = ExprCacheOrder.erase(it);
+		} else {
+			++it;
+		}
+	}
+}
+
+void clearExprCache() {
+	ExprCache.clear();
+	ExprCacheOrder.clear();
+}
+
+void newFunctionVersion(Symbol name) {
+	++FunctionVersions[name];
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// STRUCTURE
+// ====----====----====----====----====----====----====----====----====----====
+// Names are symbol ids and counts end with ';', so no two structures look alike.
+void NumberExprAST::appendStructure(std::string& key) const {
+	// The bits, so no digits get lost
+	char bits[sizeof(m_val)];
+	std::memcpy(bits, &m_val, sizeof(m_val));
+	key += m_isInt ? 'i' : 'n';
+	key.append(bits, sizeof(bits));
+}
+
+void VariableExprAST::appendStructure(std::string& key) const {
+	key += 'v';
+	appendSymbol(key, m_name);
+}
+
+void BinaryExprAST::appendStructure(std::string& key) const {
+	key += 'b';
+	key += m_op;
+	m_left->appendStructure(key);
+	m_right->appendStructure(key);
+}
+
+void VarDefExprAST::appendStructure(std::string& key) const {
+	key += 'V' + std::to_string(m_varDeclDefs.size()) + ';';
+	for (auto& ass : m_varDeclDefs) {
+		appendSymbol(key, ass.first);
+		if (ass.second) ass.second->appendStructure(key);
+		else key += '_';
+	}
+	m_innerExpr->appendStructure(key);
+}
+
+void IfThenElseExprAST::appendStructure(std::string& key) const {
+	key += '?';
+	m_cond->appendStructure(key);
+	m_thenExpr->appendStructure(key);
+	m_elseExpr->appendStructure(key);
+}
+
+void ForExprAST::appendStructure(std::string& key) const {
+	key += 'f';
+	appendSymbol(key, m_varName);
+	m_init->appendStructure(key);
+	m_cond->appendStructure(key);
+	if (m_step) m_step->appendStructure(key);
+	else key += '_';
+	m_body->appendStructure(key);
+}
+
+void WhileExprAST::appendStructure(std::string& key) const {
+	key += 'w';
+	m_cond->appendStructure(key);
+	m_body->appendStructure(key);
+}
+
+void CallExprAST::appendStructure(std::string& key) const {
+	key += 'c';
+	appendSymbol(key, m_name);
+	key += std::to_string(m_exps.size()) + ';';
+	for (auto e : m_exps)
+		e->appendStructure(key);
+}
@@ -0,0 +1,81 @@
+#ifndef EXPRCACHE_HPP
+#define EXPRCACHE_HPP
+
+#include "KaleidoscopeJIT.h"
+#include "symbols.hpp"
+
+#include <memory>
+#include <set>
+#include <string>
+
+/// Cache of compiled top-level expressions (-expr-cache=<n>).
+///
+/// An expression is keyed on its structure plus the version of every
+/// function it calls, directly or through other functions (a 'def' makes a
+/// new version), so a repeat of it reuses the compiled function, as long as
+/// nothing it reaches was redefined.
+/// If everything it calls is pure (see memo.hpp), its result is reused
+/// instead and nothing runs at all.
+///
+/// The module of a cached expression stays in the JIT until the last
+/// entry using it is evicted (oldest first).
+
+class ExprAST;
+class FlatAST;
+
+/// A compiled top-level expression.
+typedef double (*ExprFunction)();
+
+/// A module of top-level expressions in the JIT, removed with the last
+/// reference to it.
+class ExprModule {
+public:
+	explicit ExprModule(llvm::orc::KaleidoscopeJIT::ModuleHandleT handle)
+		: m_handle(handle)
+	{}
+	~ExprModule();
+
+private:
+	ExprModule(const ExprModule&) = delete;
+	ExprModule& operator=(const ExprModule&) = delete;
+
+	llvm::orc::KaleidoscopeJIT::ModuleHandleT m_handle;
+};
+
+/// A compiled expression. 'function' and 'module' are filled in once the
+/// expression went to the JIT, 'result' once it ran, if it is pure.
+struct CachedExpr {
+	CachedExpr(bool pure)
+		: pure(pure), function(nullptr), hasResult(false), result(0.0)
+	{}
+
+	bool pure;
+	ExprFunction function;
+	std::shared_ptr<ExprModule> module;
+	bool hasResult;
+	double result;
+};
+
+/// Returns the cache key of 'expr'.
+std::string exprCacheKey(const ExprAST& expr);
+
+/// Returns the cache key of the folded flat AST 'flat' (without
+/// -infer-types), where '1+2+x' and '3+x' are the same expression.
+std::string exprCacheKey(const FlatAST& flat);
+
+/// Returns the entry of 'key' (nullptr if none).
+std::shared_ptr<CachedExpr> findCachedExpr(const std::string& key);
+
+/// Adds an entry for 'key' (evicting the oldest one if the cache is full).
+std::shared_ptr<CachedExpr> addCachedExpr(const std::string& key, bool pure);
+
+/// Forgets the entries in 'entries', their expressions never made it to the JIT.
+void forgetCachedExprs(const std::set<const CachedExpr*>& entries);
+
+/// Forgets every entry (and frees their modules).
+void clearExprCache();
+
+/// Tells the cache 'name' was (re)defined.
+void newFunctionVersion(Symbol name);
+
+#endif /* ifndef EXPRCACHE_HPP */
@@ -0,0 +1,254 @@
+#include "flatast.hpp"
+#include "ast.hpp"
+#include "interp.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+
+#include <chrono>
+
+static Statistic NumFlattened("flat", "expressions flattened");
+static Statistic NumFlatNodes("flat", "nodes flattened");
+static Statistic NumFlatBytes("flat", "bytes of the flat ASTs");
+static Statistic NumTreeBytes("flat", "bytes of the ExprAST objects flattened");
+static Statistic NumFlatWalkNanos("flat", "nanoseconds walking the flat ASTs (100 times each)");
+static Statistic NumTreeWalkNanos("flat", "nanoseconds walking the ExprAST objects flattened (100 times each)");
+
+/// Walks done per flattened expression with -stats, so the time is measurable
+static const unsigned NumTimedWalks = 100;
+/// Where the node counts of the timed walks go, so they aren't optimized away
+static volatile unsigned WalkedNodes;
+
+/// Counts what 'builder' flattened from 'expr' into 'flat' and, with
+/// -stats, times walking both.
+static void countFlattened(const ExprAST& expr, const FlatAST& flat, const FlatBuilder& builder) {
+	++NumFlattened;
+	NumFlatNodes += flat.nodes.size();
+	NumFlatBytes += flat.bytes();
+	NumTreeBytes += builder.treeBytes();
+	if (! TheOptions.stats) return;
+
+	typedef std::chrono::steady_clock clock;
+	auto start = clock::now();
+	for (unsigned i = 0; i < NumTimedWalks; ++i)
+		WalkedNodes += expr.countNodes();
+	auto treeEnd = clock::now();
+	for (unsigned i = 0; i < NumTimedWalks; ++i)
+		WalkedNodes += flat.countNodes(0);
+	auto flatEnd = clock::now();
+	NumTreeWalkNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(treeEnd - start).count();
+	NumFlatWalkNanos += std::chrono::duration_cast<std::chrono::nanoseconds>(flatEnd - treeEnd).count();
+}
+
+bool flattenExpression(const ExprAST& expr, FlatAST& flat) {
+	FlatBuilder builder(flat);
+	expr.flatten(builder);
+	if (builder.failed()) return false;
+	countFlattened(expr, flat, builder);
+	return true;
+}
+
+EvalCost FlatAST::cost() const {
+	EvalCost cost;
+	cost.nodes = nodes.size();
+	for (const FlatNode& node : nodes) {
+		if (node.tag == FlatFor || node.tag == FlatWhile) ++cost.loops;
+		if (node.tag == FlatCall && node.count > cost.maxArgs) cost.maxArgs = node.count;
+	}
+	return cost;
+}
+
+size_t FlatAST::bytes() const {
+	return sizeof(*this) + nodes.capacity() * sizeof(FlatNode) + numbers.capacity() * sizeof(double)
+		+ (callees.capacity() + slots.capacity()) * sizeof(Symbol);
+}
+
+unsigned FlatAST::countNodes(uint32_t index) const {
+	unsigned count = 1;
+	for (uint32_t child = index + 1; child < next(index); child = next(child))
+		count += countNodes(child);
+	return count;
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// BUILDER
+// ====----====----====----====----====----====----====----====----====----====
+uint32_t FlatBuilder::open(FlatTag tag, size_t treeBytes) {
+	m_treeBytes += treeBytes;
+	m_flat.nodes.push_back(FlatNode{tag, 0, 0, 0, 0});
+	return m_flat.nodes.size() - 1;
+}
+
+void FlatBuilder::close(uint32_t index) {
+	m_flat.nodes[index].size = m_flat.nodes.size() - index;
+}
+
+uint32_t FlatBuilder::number(double value) {
+	m_flat.numbers.push_back(value);
+	return m_flat.numbers.size() - 1;
+}
+
+uint32_t FlatBuilder::callee(Symbol name) {
+	auto inserted = m_callees.insert(std::make_pair(name, (uint32_t)m_flat.callees.size()));
+	if (inserted.second) m_flat.callees.push_back(name);
+	return inserted.first->second;
+}
+
+uint32_t FlatBuilder::lookup(Symbol name) {
+	auto found = m_slots.find(name);
+	if (found == m_slots.end()) {
+		fail();
+		return 0;
+	}
+	return found->second.back();
+}
+
+uint32_t FlatBuilder::declare(Symbol name) {
+	uint32_t slot = m_flat.slots.size();
+	m_slots[name].push_back(slot);
+	m_flat.slots.push_back(name);
+	return slot;
+}
+
+void FlatBuilder::undeclare(Symbol name) {
+	auto found = m_slots.find(name);
+	found->second.pop_back();
+	if (found->second.empty()) m_slots.erase(found);
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// FLATTENING
+// ====----====----====----====----====----====----====----====----====----====
+// Every node adds itself, then its children in the order of FlatTag.
+void NumberExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatNumber, sizeof(*this));
+	builder.node(index).op = m_isInt ? 'i' : 0;
+	builder.node(index).operand = builder.number(m_val);
+	builder.close(index);
+}
+
+void VariableExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatVariable, sizeof(*this));
+	builder.node(index).operand = builder.lookup(m_name);
+	builder.close(index);
+}
+
+void BinaryExprAST::flatten(FlatBuilder& builder) const {
+	if (m_op == '=') {
+		uint32_t index = builder.open(FlatAssign, sizeof(*this));
+		VariableExprAST* varAST = dynamic_cast<VariableExprAST*>(m_left);
+		if (varAST == nullptr) builder.fail();
+		else builder.node(index).operand = builder.lookup(varAST->name());
+		m_right->flatten(builder);
+		builder.close(index);
+		return;
+	}
+
+	uint32_t index = builder.open(FlatBinary, sizeof(*this));
+	builder.node(index).op = m_op;
+	m_left->flatten(builder);
+	m_right->flatten(builder);
+	builder.close(index);
+}
+
+void VarDefExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatVarDef,
+		sizeof(*this) + m_varDeclDefs.capacity() * sizeof(m_varDeclDefs[0]));
+	if (m_varDeclDefs.size() > UINT16_MAX) builder.fail();
+	builder.node(index).count = m_varDeclDefs.size();
+	for (auto& ass : m_varDeclDefs) {
+		uint32_t assign = builder.open(FlatAssign, 0);
+		if (ass.second) ass.second->flatten(builder);
+		else {
+			uint32_t zero = builder.open(FlatNumber, 0);
+			builder.node(zero).operand = builder.number(0.0);
+			builder.close(zero);
+		}
+		// The initializer still sees the outer variable of the same name
+		builder.node(assign).operand = builder.declare(ass.first);
+		builder.close(assign);
+	}
+	m_innerExpr->flatten(builder);
+	for (auto& ass : m_varDeclDefs)
+		builder.undeclare(ass.first);
+	builder.close(index);
+}
+
+void IfThenElseExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatIf, sizeof(*this));
+	m_cond->flatten(builder);
+	m_thenExpr->flatten(builder);
+	m_elseExpr->flatten(builder);
+	builder.close(index);
+}
+
+void ForExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatFor, sizeof(*this));
+	m_init->flatten(builder);
+	builder.node(index).operand = builder.declare(m_varName);
+	builder.node(index).count = m_step ? 1 : 0;
+	m_cond->flatten(builder);
+	if (m_step) m_step->flatten(builder);
+	m_body->flatten(builder);
+	builder.undeclare(m_varName);
+	builder.close(index);
+}
+
+void WhileExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatWhile, sizeof(*this));
+	m_cond->flatten(builder);
+	m_body->flatten(builder);
+	builder.close(index);
+}
+
+void CallExprAST::flatten(FlatBuilder& builder) const {
+	uint32_t index = builder.open(FlatCall, sizeof(*this) + m_exps.capacity() * sizeof(ExprAST*));
+	// The argument count has to fit in FlatNode::count
+	if (m_exps.size() > UINT16_MAX) builder.fail();
+	builder.node(index).count = m_exps.size();
+	builder.node(index).operand = builder.callee(m_name);
+	for (auto e : m_exps)
+		e->flatten(builder);
+	builder.close(index);
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// TIMED WALK
+// ====----====----====----====----====----====----====----====----====----====
+unsigned NumberExprAST::countNodes() const {
+	return 1;
+}
+
+unsigned VariableExprAST::countNodes() const {
+	return 1;
+}
+
+unsigned BinaryExprAST::countNodes() const {
+	return 1 + m_left->countNodes() + m_right->countNodes();
+}
+
+unsigned VarDefExprAST::countNodes() const {
+	unsigned count = 1;
+	for (auto& ass : m_varDeclDefs)
+		if (ass.second) count += ass.second->countNodes();
+	return count + m_innerExpr->countNodes();
+}
+
+unsigned IfThenElseExprAST::countNodes() const {
+	return 1 + m_cond->countNodes() + m_thenExpr->countNodes() + m_elseExpr->countNodes();
+}
+
+unsigned ForExprAST::countNodes() const {
+	return 1 + m_init->countNodes() + m_cond->countNodes()
+		+ (m_step ? m_step->countNodes() : 0) + m_body->countNodes();
+}
+
+unsigned WhileExprAST::countNodes() const {
+	return 1 + m_cond->countNodes() + m_body->countNodes();
+}
+
+unsigned CallExprAST::countNodes() const {
+	unsigned count = 1;
+	for (auto e : m_exps)
+		count += e->countNodes();
+	return count;
+}
@@ -0,0 +1,108 @@
+#ifndef FLATAST_HPP
+#define FLATAST_HPP
+
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "symbols.hpp"
+
+/// A flat copy of a top-level expression.
+///
+/// Walking the ExprAST objects means a cache miss and a virtual call per
+/// node. The flat AST keeps all nodes of an expression in one array, in
+/// preorder: the first child of a node comes right after it, the next
+/// sibling of a child comes 'size' nodes after it. Nodes are addressed by
+/// 32-bit indices and walked with a switch on their tag. Variables are
+/// resolved to slots while flattening, so nothing looks up a name.
+///
+/// Without -infer-types a top-level expression is folded (FoldConstants()),
+/// keyed for -expr-cache and interpreted over it. Codegen stays on the
+/// ExprAST objects, the one place the types and scopes of the tree live
+/// (an expression compiled after all gets its tree folded then).
+
+enum FlatTag : uint8_t {
+	FlatNumber,   // numbers[operand], 'op' is 'i' if written as an integer
+	FlatVariable, // slot 'operand'
+	FlatAssign,   // slot 'operand' = child
+	FlatBinary,   // 'op' of 2 children
+	FlatIf,       // condition, then, else
+	FlatFor,      // slot 'operand' = init; condition, step (if 'count' is 1), body
+	FlatWhile,    // condition, body
+	FlatVarDef,   // 'count' assignments of its variables, then the body
+	FlatCall,     // callees[operand] with 'count' arguments
+};
+
+struct FlatNode {
+	FlatTag tag;
+	char op;
+	uint16_t count;
+	/// Nodes in the subtree of this one (itself included)
+	uint32_t size;
+	uint32_t operand;
+};
+
+class ExprAST;
+struct EvalCost;
+
+class FlatAST {
+public:
+	/// The node after the subtree of node 'index'.
+	uint32_t next(uint32_t index) const { return index + nodes[index].size; }
+	/// What interpreting the expression involves.
+	EvalCost cost() const;
+	/// Bytes taken by the flat AST.
+	size_t bytes() const;
+	/// Counts the nodes of the subtree of node 'index' walking it child by
+	/// child, to time it against ExprAST::countNodes() (-stats).
+	unsigned countNodes(uint32_t index) const;
+
+	std::vector<FlatNode> nodes;
+	std::vector<double> numbers;
+	std::vector<Symbol> callees;
+	/// The name of every variable (each declaration gets a slot of its own)
+	std::vector<Symbol> slots;
+};
+
+/// Fills a FlatAST, called by ExprAST::flatten().
+class FlatBuilder {
+public:
+	explicit FlatBuilder(FlatAST& flat) : m_flat(flat), m_treeBytes(0), m_failed(false) {}
+
+	/// Adds a node whose children follow (added by the caller until
+	/// close()). 'treeBytes' is what the ExprAST object takes.
+	uint32_t open(FlatTag tag, size_t treeBytes);
+	void close(uint32_t index);
+	FlatNode& node(uint32_t index) { return m_flat.nodes[index]; }
+
+	uint32_t number(double value);
+	uint32_t callee(Symbol name);
+
+	/// Returns the slot of variable 'name', failing if there is none.
+	uint32_t lookup(Symbol name);
+	/// Returns a new slot for 'name', shadowing any outer variable of
+	/// that name until undeclare().
+	uint32_t declare(Symbol name);
+	void undeclare(Symbol name);
+
+	/// Stops flattening (the expression is compiled instead, which reports
+	/// the error).
+	void fail() { m_failed = true; }
+	bool failed() const { return m_failed; }
+
+	/// Bytes taken by the flattened ExprAST objects (and their vectors).
+	size_t treeBytes() const { return m_treeBytes; }
+
+private:
+	FlatAST& m_flat;
+	std::unordered_map<Symbol, std::vector<uint32_t> > m_slots;
+	std::unordered_map<Symbol, uint32_t> m_callees;
+	size_t m_treeBytes;
+	bool m_failed;
+};
+
+/// Flattens 'expr' into 'flat'. Returns false if it can't be flattened
+/// (ex. an unknown variable, codegen of the tree reports it).
+bool flattenExpression(const ExprAST& expr, FlatAST& flat);
+
+#endif /* ifndef FLATAST_HPP */
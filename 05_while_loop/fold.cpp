@@ -0,0 +1,238 @@
+#include "ast.hpp"
+#include "stats.hpp"
+
+#include <algorithm>
+#include <cmath>
+
+static Statistic NumFolded("fold", "expressions folded to a constant");
+static Statistic NumBranchesFolded("fold", "ifs with a constant condition folded");
+static Statistic NumFlatFolded("fold", "flat AST operations folded to a constant");
+static Statistic NumFlatBranchesFolded("fold", "flat AST ifs with a constant condition folded");
+
+ExprAST* FoldConstants(ExprAST* expr) {
+	return expr->fold();
+}
+
+bool isConstant(const ExprAST* expr, double& val) {
+	const NumberExprAST* number = dynamic_cast<const NumberExprAST*>(expr);
+	if (number == nullptr) return false;
+	val = number->value();
+	return true;
+}
+
+/// Folds the child 'expr' in place.
+static void foldChild(ExprAST*& expr) {
+	if (expr) expr = FoldConstants(expr);
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// CONSTANT FOLDING
+// ====----====----====----====----====----====----====----====----====----====
+ExprAST* NumberExprAST::fold() {
+	return this;
+}
+
+ExprAST* VariableExprAST::fold() {
+	return this;
+}
+
+ExprAST* BinaryExprAST::fold() {
+	// The left side of '=' is a variable, it stays
+	if (m_op != '=') foldChild(m_left);
+	foldChild(m_right);
+
+	double left, right;
+	if (! isConstant(m_left, left)) return this;
+
+	// A constant has no side effects, so it can be dropped
+	if (m_op == ':') return m_right;
+	if (! isConstant(m_right, right)) return this;
+
+	// Computed the way the generated code does
+	double val;
+	switch (m_op) {
+		case '+': val = left + right; break;
+		case '-': val = left - right; break;
+		case '*': val = left * right; break;
+		case '<': val = (left < right || std::isnan(left) || std::isnan(right)) ? 1.0 : 0.0; break;
+		case '>': val = (left > right || std::isnan(left) || std::isnan(right)) ? 1.0 : 0.0; break;
+		default: return this;
+	}
+
+	// Integers stay integers while doubles hold them exactly (see types.hpp)
+	bool isInt = static_cast<NumberExprAST*>(m_left)->isInt()
+		&& static_cast<NumberExprAST*>(m_right)->isInt();
+	if (isInt && std::fabs(val) >= 9007199254740992.0) return this;
+
+	++NumFolded;
+	return newAST<NumberExprAST>(val, isInt || m_op == '<' || m_op == '>');
+}
+
+ExprAST* VarDefExprAST::fold() {
+	for (auto& ass : m_varDeclDefs)
+		foldChild(ass.second);
+	foldChild(m_innerExpr);
+	return this;
+}
+
+ExprAST* IfThenElseExprAST::fold() {
+	foldChild(m_cond);
+	foldChild(m_thenExpr);
+	foldChild(m_elseExpr);
+
+	double cond;
+	if (! isConstant(m_cond, cond)) return this;
+
+	++NumBranchesFolded;
+	// Like the generated code: NaN is false
+	return cond != 0.0 && ! std::isnan(cond) ? m_thenExpr : m_elseExpr;
+}
+
+ExprAST* ForExprAST::fold() {
+	foldChild(m_init);
+	foldChild(m_cond);
+	foldChild(m_step);
+	foldChild(m_body);
+	return this;
+}
+
+ExprAST* WhileExprAST::fold() {
+	foldChild(m_cond);
+	foldChild(m_body);
+	return this;
+}
+
+ExprAST* CallExprAST::fold() {
+	for (auto& e : m_exps)
+		foldChild(e);
+	return this;
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// FLAT CONSTANT FOLDING
+// ====----====----====----====----====----====----====----====----====----====
+/// Copies the nodes of a flat AST, folding them on the way: a subtree is
+/// folded after its children, once they are in place at the end of the
+/// copy, and replaced by dropping the nodes after its own.
+class FlatFolder {
+public:
+	FlatFolder(const FlatAST& flat, FlatAST& folded) : m_flat(flat), m_folded(folded) {}
+
+	/// Appends the folded subtree of node 'index' and returns where it went.
+	uint32_t fold(uint32_t index);
+
+private:
+	/// If node 'at' of the copy is a constant, stores it in 'val' and returns true.
+	bool isConstant(uint32_t at, double& val) const;
+	/// Replaces the subtree at 'at' (the last one) with the number 'val'.
+	uint32_t replaceWithNumber(uint32_t at, double val, bool isInt);
+	/// Replaces the subtree at 'at' with its child at 'child' (the last one).
+	uint32_t replaceWithChild(uint32_t at, uint32_t child);
+	/// The subtree at 'at' is complete.
+	uint32_t close(uint32_t at);
+
+	const FlatAST& m_flat;
+	FlatAST& m_folded;
+};
+
+void FoldConstants(FlatAST& flat) {
+	FlatAST folded;
+	folded.callees = flat.callees;
+	folded.slots = flat.slots;
+	FlatFolder(flat, folded).fold(0);
+	flat = std::move(folded);
+}
+
+bool isConstant(const FlatAST& flat, double& val) {
+	if (flat.nodes.empty() || flat.nodes[0].tag != FlatNumber) return false;
+	val = flat.numbers[flat.nodes[0].operand];
+	return true;
+}
+
+bool FlatFolder::isConstant(uint32_t at, double& val) const {
+	const FlatNode& node = m_folded.nodes[at];
+	if (node.tag != FlatNumber) return false;
+	val = m_folded.numbers[node.operand];
+	return true;
+}
+
+uint32_t FlatFolder::replaceWithNumber(uint32_t at, double val, bool isInt) {
+	// The numbers of the dropped nodes stay in the table
+	m_folded.nodes.resize(at);
+	m_folded.numbers.push_back(val);
+	m_folded.nodes.push_back(FlatNode{FlatNumber, isInt ? 'i' : (char)0, 0, 1,
+			(uint32_t)m_folded.numbers.size() - 1});
+	return at;
+}
+
+uint32_t FlatFolder::replaceWithChild(uint32_t at, uint32_t child) {
+	// Sizes are relative, so the subtree stays valid wherever it goes
+	auto& nodes = m_folded.nodes;
+	std::copy(nodes.begin() + child, nodes.end(), nodes.begin() + at);
+	nodes.resize(nodes.size() - (child - at));
+	return at;
+}
+
+uint32_t FlatFolder::close(uint32_t at) {
+	m_folded.nodes[at].size = m_folded.nodes.size() - at;
+	return at;
+}
+
+// Same rules as the tree, see ExprAST::fold()
+uint32_t FlatFolder::fold(uint32_t index) {
+	const FlatNode& node = m_flat.nodes[index];
+	uint32_t child = index + 1;
+	uint32_t at = m_folded.nodes.size();
+	m_folded.nodes.push_back(node);
+
+	switch (node.tag) {
+		case FlatNumber:
+			return replaceWithNumber(at, m_flat.numbers[node.operand], node.op == 'i');
+		case FlatBinary: {
+			uint32_t left = fold(child);
+			uint32_t right = fold(m_flat.next(child));
+			double leftVal, rightVal;
+			if (! isConstant(left, leftVal)) return close(at);
+
+			// A constant has no side effects, so it can be dropped
+			if (node.op == ':') return replaceWithChild(at, right);
+			if (! isConstant(right, rightVal)) return close(at);
+
+			// Computed the way the generated code does
+			double val;
+			switch (node.op) {
+				case '+': val = leftVal + rightVal; break;
+				case '-': val = leftVal - rightVal; break;
+				case '*': val = leftVal * rightVal; break;
+				case '<': val = (leftVal < rightVal || std::isnan(leftVal) || std::isnan(rightVal)) ? 1.0 : 0.0; break;
+				case '>': val = (leftVal > rightVal || std::isnan(leftVal) || std::isnan(rightVal)) ? 1.0 : 0.0; break;
+				default: return close(at);
+			}
+
+			// Integers stay integers while doubles hold them exactly (see types.hpp)
+			bool isInt = m_folded.nodes[left].op == 'i' && m_folded.nodes[right].op == 'i';
+			if (isInt && std::fabs(val) >= 9007199254740992.0) return close(at);
+
+			++NumFlatFolded;
+			return replaceWithNumber(at, val, isInt || node.op == '<' || node.op == '>');
+		}
+		case FlatIf: {
+			uint32_t thenExpr = m_flat.next(child);
+			uint32_t cond = fold(child);
+			double condVal;
+			if (isConstant(cond, condVal)) {
+				++NumFlatBranchesFolded;
+				// Like the generated code: NaN is false, only the branch taken stays
+				m_folded.nodes.resize(at);
+				return fold(condVal != 0.0 && ! std::isnan(condVal) ? thenExpr : m_flat.next(thenExpr));
+			}
+			fold(thenExpr);
+			fold(m_flat.next(thenExpr));
+			return close(at);
+		}
+		default:
+			for (; child < m_flat.next(index); child = m_flat.next(child))
+				fold(child);
+			return close(at);
+	}
+}
@@ -0,0 +1,252 @@
+#include "interp.hpp"
+#include "ast.hpp"
+
+#include <cmath>
+
+extern std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
+
+double* Interpreter::lookup(Symbol name) {
+	auto found = m_vars.find(name);
+	if (found == m_vars.end() || found->second.empty()) return nullptr;
+	return &found->second.back();
+}
+
+void Interpreter::declare(Symbol name, double value) {
+	m_vars[name].push_back(value);
+}
+
+void Interpreter::undeclare(Symbol name) {
+	auto found = m_vars.find(name);
+	found->second.pop_back();
+	if (found->second.empty()) m_vars.erase(found);
+}
+
+double Interpreter::fail(const std::string& errMsg) {
+	logError(errMsg);
+	m_failed = true;
+	return 0.0;
+}
+
+double Interpreter::call(uint64_t address, const double* args, unsigned count) {
+	typedef double D;
+	const double* a = args;
+	switch (count) {
+		case 0: return ((D (*)())address)();
+		case 1: return ((D (*)(D))address)(a[0]);
+		case 2: return ((D (*)(D, D))address)(a[0], a[1]);
+		case 3: return ((D (*)(D, D, D))address)(a[0], a[1], a[2]);
+		case 4: return ((D (*)(D, D, D, D))address)(a[0], a[1], a[2], a[3]);
+		case 5: return ((D (*)(D, D, D, D, D))address)(a[0], a[1], a[2], a[3], a[4]);
+		default: return ((D (*)(D, D, D, D, D, D))address)(a[0], a[1], a[2], a[3], a[4], a[5]);
+	}
+}
+
+/// Like the generated code: non-zero values are true, NaN isn't.
+static bool isTrue(double value) {
+	return value != 0.0 && ! std::isnan(value);
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// INTERPRETER
+// ====----====----====----====----====----====----====----====----====----====
+// Every node does what its codegen() generates (without -infer-types).
+double NumberExprAST::eval(Interpreter& env) const {
+	return m_val;
+}
+
+double VariableExprAST::eval(Interpreter& env) const {
+	double* var = env.lookup(m_name);
+	if (! var) return env.fail("Unknown variable: '" + m_name.str() + "'");
+	return *var;
+}
+
+double BinaryExprAST::eval(Interpreter& env) const {
+	if (m_op == '=') {
+		double value = m_right->eval(env);
+		VariableExprAST* varAST = dynamic_cast<VariableExprAST*>(m_left);
+		if (varAST == nullptr) return env.fail("Bad left operand in assignment operator '='");
+		double* var = env.lookup(varAST->name());
+		if (! var) return env.fail("Unknown variable: '" + varAST->name().str() + "'");
+		*var = value;
+		return value;
+	}
+
+	double left = m_left->eval(env);
+	if (env.failed()) return 0.0;
+	double right = m_right->eval(env);
+	switch (m_op) {
+		case ':': return right;
+		case '+': return left + right;
+		case '-': return left - right;
+		case '*': return left * right;
+		// Unordered comparisons, so NaN compares true
+		case '<': return (left < right || std::isnan(left) || std::isnan(right)) ? 1.0 : 0.0;
+		case '>': return (left > right || std::isnan(left) || std::isnan(right)) ? 1.0 : 0.0;
+		default: return env.fail(std::string("Unknown binary operator '") + m_op + "'");
+	}
+}
+
+double VarDefExprAST::eval(Interpreter& env) const {
+	for (auto &ass : m_varDeclDefs) {
+		// The initializer still sees the outer variable of the same name
+		double init = ass.second ? ass.second->eval(env) : 0.0;
+		env.declare(ass.first, init);
+	}
+
+	double body = m_innerExpr->eval(env);
+
+	for (auto &ass : m_varDeclDefs)
+		env.undeclare(ass.first);
+	return body;
+}
+
+double IfThenElseExprAST::eval(Interpreter& env) const {
+	double cond = m_cond->eval(env);
+	if (env.failed()) return 0.0;
+	return isTrue(cond) ? m_thenExpr->eval(env) : m_elseExpr->eval(env);
+}
+
+double ForExprAST::eval(Interpreter& env) const {
+	env.declare(m_varName, m_init->eval(env));
+	while (! env.failed() && isTrue(m_cond->eval(env))) {
+		m_body->eval(env);
+		double step = m_step ? m_step->eval(env) : 1.0;
+		// The body may have assigned the variable, the step adds to that
+		*env.lookup(m_varName) += step;
+	}
+	env.undeclare(m_varName);
+	return 0.0;
+}
+
+double WhileExprAST::eval(Interpreter& env) const {
+	while (! env.failed() && isTrue(m_cond->eval(env)))
+		m_body->eval(env);
+	return 0.0;
+}
+
+double CallExprAST::eval(Interpreter& env) const {
+	// Not getFunction(), the declaration it adds to TheModule would tell
+	// the driver compiled expressions call it
+	int arity = functionArity(m_name);
+	if (arity < 0) return env.fail("Failed finding function: '" + m_name.str() + "'");
+	if (m_exps.size() != (unsigned)arity)
+		return env.fail("Function '" + m_name.str() + "' expects " + std::to_string(arity)
+				+ " arguments, " + std::to_string(m_exps.size()) + " given");
+	if (m_exps.size() > MaxEvalArgs) return env.fail("Too many arguments to interpret a call of '" + m_name.str() + "'");
+
+	double args[MaxEvalArgs];
+	for (unsigned k = 0; k < m_exps.size(); ++k) {
+		args[k] = m_exps[k]->eval(env);
+		if (env.failed()) return 0.0;
+	}
+
+	// Definitions are JITed by now, externs are in the process (the JIT
+	// finds both, TheModule isn't needed)
+	uint64_t address = TheJIT->getSymbolAddress(m_name.str());
+	if (! address) return env.fail("Failed finding function: '" + m_name.str() + "'");
+	return Interpreter::call(address, args, m_exps.size());
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// FLAT INTERPRETER
+// ====----====----====----====----====----====----====----====----====----====
+FlatInterpreter::FlatInterpreter(const FlatAST& flat)
+	: m_flat(flat), m_slots(flat.slots.size(), 0.0), m_addresses(flat.callees.size(), 0), m_failed(false)
+{}
+
+double FlatInterpreter::fail(const std::string& errMsg) {
+	logError(errMsg);
+	m_failed = true;
+	return 0.0;
+}
+
+double FlatInterpreter::run() {
+	// Every call is checked (and its callee looked up) once, up front
+	for (const FlatNode& node : m_flat.nodes) {
+		if (node.tag != FlatCall) continue;
+		Symbol name = m_flat.callees[node.operand];
+		// Leaves TheModule alone, like the tree interpreter
+		int arity = functionArity(name);
+		if (arity < 0) return fail("Failed finding function: '" + name.str() + "'");
+		if (node.count != (unsigned)arity)
+			return fail("Function '" + name.str() + "' expects " + std::to_string(arity)
+					+ " arguments, " + std::to_string(node.count) + " given");
+		if (m_addresses[node.operand]) continue;
+		// Definitions are JITed by now, externs are in the process
+		m_addresses[node.operand] = TheJIT->getSymbolAddress(name.str());
+		if (! m_addresses[node.operand]) return fail("Failed finding function: '" + name.str() + "'");
+	}
+	return eval(0);
+}
+
+// Like the tree interpreter, but the children of a node are found by
+// index: the first right after it, every other one after the subtree of
+// the one before.
+double FlatInterpreter::eval(uint32_t index) {
+	const FlatNode& node = m_flat.nodes[index];
+	uint32_t child = index + 1;
+	switch (node.tag) {
+		case FlatNumber: return m_flat.numbers[node.operand];
+		case FlatVariable: return m_slots[node.operand];
+		case FlatAssign: {
+			double value = eval(child);
+			m_slots[node.operand] = value;
+			return value;
+		}
+		case FlatBinary: {
+			double left = eval(child);
+			double right = eval(m_flat.next(child));
+			switch (node.op) {
+				case ':': return right;
+				case '+': return left + right;
+				case '-': return left - right;
+				case '*': return left * right;
+				// Unordered comparisons, so NaN compares true
+				case '<': return (left < right || std::isnan(left) || std::isnan(right)) ? 1.0 : 0.0;
+				case '>': return (left > right || std::isnan(left) || std::isnan(right)) ? 1.0 : 0.0;
+				default: return fail(std::string("Unknown binary operator '") + node.op + "'");
+			}
+		}
+		case FlatIf: {
+			uint32_t thenExpr = m_flat.next(child);
+			if (isTrue(eval(child))) return eval(thenExpr);
+			return eval(m_flat.next(thenExpr));
+		}
+		case FlatFor: {
+			uint32_t cond = m_flat.next(child);
+			uint32_t step = m_flat.next(cond);
+			uint32_t body = node.count ? m_flat.next(step) : step;
+			m_slots[node.operand] = eval(child);
+			while (! m_failed && isTrue(eval(cond))) {
+				eval(body);
+				double stepValue = node.count ? eval(step) : 1.0;
+				// The body may have assigned the variable, the step adds to that
+				m_slots[node.operand] += stepValue;
+			}
+			return 0.0;
+		}
+		case FlatWhile: {
+			uint32_t body = m_flat.next(child);
+			while (! m_failed && isTrue(eval(child)))
+				eval(body);
+			return 0.0;
+		}
+		case FlatVarDef: {
+			for (unsigned k = 0; k < node.count; ++k) {
+				eval(child);
+				child = m_flat.next(child);
+			}
+			return eval(child);
+		}
+		case FlatCall: {
+			double args[MaxEvalArgs];
+			for (unsigned k = 0; k < node.count; ++k) {
+				args[k] = eval(child);
+				child = m_flat.next(child);
+			}
+			if (m_failed) return 0.0;
+			return Interpreter::call(m_addresses[node.operand], args, node.count);
+		}
+	}
+	return fail("Unknown flat AST node");
+}
@@ -0,0 +1,86 @@
+#ifndef INTERP_HPP
+#define INTERP_HPP
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "symbols.hpp"
+
+/// Tier 0 for top-level expressions: an interpreter of the flat AST
+/// (FlatInterpreter, see flatast.hpp), or with -interp-ast=tree one walking
+/// the syntax tree (ExprAST::eval()). Both know doubles only, like the code
+/// without -infer-types.
+///
+/// A top-level expression usually runs once, and compiling it takes far
+/// longer than running it. With -interp the driver interprets those that
+/// are cheap to interpret: ones without loops, where every call goes to a
+/// JITed function (or an extern) and so runs at full speed anyway.
+
+/// The most arguments a call from the interpreter can pass.
+static const unsigned MaxEvalArgs = 6;
+
+/// What the interpreter would be up against, see FlatAST::cost().
+struct EvalCost {
+	EvalCost() : nodes(0), loops(0), maxArgs(0) {}
+
+	unsigned nodes;
+	unsigned loops;
+	/// Arguments of the call with the most
+	unsigned maxArgs;
+};
+
+/// The state of one interpreted expression: the variables in scope, and
+/// if it failed (after an error was reported).
+class Interpreter {
+public:
+	Interpreter() : m_failed(false) {}
+
+	/// Returns the variable 'name' (nullptr if there is none in scope).
+	double* lookup(Symbol name);
+	/// Declares 'name', shadowing any outer variable of that name.
+	void declare(Symbol name, double value);
+	/// Ends the scope of the innermost 'name'.
+	void undeclare(Symbol name);
+
+	/// Reports 'errMsg', stops the interpreter and returns 0.
+	double fail(const std::string& errMsg);
+	bool failed() const { return m_failed; }
+
+	/// Calls the function at 'address' with 'count' (at most MaxEvalArgs) 'args'.
+	static double call(uint64_t address, const double* args, unsigned count);
+
+private:
+	/// Every name maps to its variables, innermost last
+	std::unordered_map<Symbol, std::vector<double> > m_vars;
+	bool m_failed;
+};
+
+class FlatAST;
+
+/// Interprets a flat AST with a switch on the tag of every node.
+class FlatInterpreter {
+public:
+	explicit FlatInterpreter(const FlatAST& flat);
+
+	/// Returns the value of the expression (0 if it failed).
+	double run();
+
+	/// Reports 'errMsg', stops the interpreter and returns 0.
+	double fail(const std::string& errMsg);
+	bool failed() const { return m_failed; }
+
+private:
+	/// Returns the value of node 'index'.
+	double eval(uint32_t index);
+
+	const FlatAST& m_flat;
+	/// The variables
+	std::vector<double> m_slots;
+	/// The address of every callee, looked up before running
+	std::vector<uint64_t> m_addresses;
+	bool m_failed;
+};
+
+#endif /* ifndef INTERP_HPP */
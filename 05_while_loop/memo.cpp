@@ -0,0 +1,204 @@
+#include "memo.hpp"
+#include "ast.hpp"
+#include "options.hpp"
+
+#include <cstring>
+#include <deque>
+#include <iomanip>
+#include <memory>
+#include <mutex>
+#include <set>
+#include <unordered_set>
+
+/// Slots looked at from the home slot before giving up
+static const size_t MaxProbes = 8;
+
+MemoTable::MemoTable(std::string name, unsigned arity, size_t capacity, bool evict)
+	: m_name(name), m_arity(arity), m_evict(evict),
+	  m_hits(0), m_misses(0), m_evictions(0), m_dropped(0)
+{
+	size_t size = 1;
+	while (size < capacity) size <<= 1;
+	m_mask = size - 1;
+	m_keys.resize(size * arity);
+	m_results.resize(size);
+	m_used.resize(size);
+}
+
+size_t MemoTable::homeSlot(const double* args) const {
+	uint64_t hash = 0;
+	for (unsigned i = 0; i < m_arity; ++i) {
+		uint64_t bits;
+		std::memcpy(&bits, &args[i], sizeof(bits));
+		// splitmix64 finalizer over the running hash
+		hash ^= bits + 0x9e3779b97f4a7c15ULL + (hash << 6) + (hash >> 2);
+		hash = (hash ^ (hash >> 30)) * 0xbf58476d1ce4e5b9ULL;
+		hash = (hash ^ (hash >> 27)) * 0x94d049bb133111ebULL;
+		hash ^= hash >> 31;
+	}
+	return hash & m_mask;
+}
+
+bool MemoTable::matches(size_t slot, const double* args) const {
+	// Bitwise, so 0.0 and -0.0 are different arguments
+	return std::memcmp(&m_keys[slot * m_arity], args, m_arity * sizeof(double)) == 0;
+}
+
+bool MemoTable::lookup(const double* args, double& result) {
+	size_t home = homeSlot(args);
+	for (size_t i = 0; i < MaxProbes; ++i) {
+		size_t slot = (home + i) & m_mask;
+		if (! m_used[slot]) break;
+		if (matches(slot, args)) {
+			++m_hits;
+			result = m_results[slot];
+			return true;
+		}
+	}
+	++m_misses;
+	return false;
+}
+
+void MemoTable::insert(const double* args, double result) {
+	size_t home = homeSlot(args);
+	size_t slot = home;
+	for (size_t i = 0; i < MaxProbes; ++i) {
+		slot = (home + i) & m_mask;
+		// A recursive call may have cached it meanwhile
+		if (! m_used[slot] || matches(slot, args)) break;
+	}
+	if (m_used[slot] && ! matches(slot, args)) {
+		if (! m_evict) {
+			++m_dropped;
+			return;
+		}
+		++m_evictions;
+		slot = home;
+	}
+	m_used[slot] = 1;
+	std::memcpy(&m_keys[slot * m_arity], args, m_arity * sizeof(double));
+	m_results[slot] = result;
+}
+
+void MemoTable::printStats(std::ostream& os) const {
+	uint64_t lookups = m_hits + m_misses;
+	os << "; memo '" << m_name << "': " << m_hits << " hits, " << m_misses << " misses";
+	if (lookups) os << " (" << std::fixed << std::setprecision(1) << 100.0 * m_hits / lookups << "% hits)";
+	os << ", " << m_evictions << " evictions, " << m_dropped << " dropped" << std::endl;
+}
+
+/// Functions found pure when they were defined
+static std::unordered_set<Symbol> PureFunctions;
+static std::mutex PureFunctionsMutex;
+
+/// Functions called by JITed code that are pure
+static const std::unordered_set<Symbol>& pureBuiltins() {
+	static const std::unordered_set<Symbol> builtins = {
+		Symbol::intern("sin"), Symbol::intern("cos"), Symbol::intern("tan"), Symbol::intern("sqrt"),
+		Symbol::intern("exp"), Symbol::intern("log"), Symbol::intern("pow"), Symbol::intern("fabs"),
+		Symbol::intern("floor"), Symbol::intern("ceil")
+	};
+	return builtins;
+}
+
+/// Returns true if 'callee' is pure. PureFunctionsMutex must be held.
+static bool isPureCallee(Symbol callee) {
+	return PureFunctions.count(callee) || pureBuiltins().count(callee);
+}
+
+bool checkPurity(const FunctionAST& fun, Symbol& impureCallee) {
+	std::set<Symbol> callees;
+	fun.body()->collectCalls(callees);
+
+	std::lock_guard<std::mutex> lock(PureFunctionsMutex);
+	bool pure = true;
+	for (auto& callee : callees) {
+		if (callee == fun.name() || isPureCallee(callee)) continue;
+		impureCallee = callee;
+		pure = false;
+		break;
+	}
+
+	if (pure) PureFunctions.insert(fun.name());
+	else PureFunctions.erase(fun.name());
+	return pure;
+}
+
+bool isPureExpression(const ExprAST& expr) {
+	std::set<Symbol> callees;
+	expr.collectCalls(callees);
+
+	std::lock_guard<std::mutex> lock(PureFunctionsMutex);
+	for (auto& callee : callees)
+		if (! isPureCallee(callee)) return false;
+	return true;
+}
+
+/// Every table ever handed out (memoized code points into them)
+static std::deque<std::unique_ptr<MemoTable> > MemoTables;
+static std::mutex MemoTablesMutex;
+
+MemoTable* newMemoTable(const std::string& name, unsigned arity) {
+	std::lock_guard<std::mutex> lock(MemoTablesMutex);
+	MemoTables.push_back(std::unique_ptr<MemoTable>(
+			new MemoTable(name, arity, TheOptions.memoCapacity, TheOptions.memoEvict)));
+	return MemoTables.back().get();
+}
+
+void printMemoStatistics(std::ostream& os) {
+	std::lock_guard<std::mutex> lock(MemoTablesMutex);
+	for (auto& table : MemoTables)
+		table->printStats(os);
+}
+
+extern "C" int kal_memo_lookup(void* table, const double* args, double* result) {
+	return static_cast<MemoTable*>(table)->lookup(args, *result);
+}
+
+extern "C" void kal_memo_insert(void* table, const double* args, double result) {
+	static_cast<MemoTable*>(table)->insert(args, result);
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// CALLS
+// ====----====----====----====----====----====----====----====----====----====
+void NumberExprAST::collectCalls(std::set<Symbol>& callees) const {
+}
+
+void VariableExprAST::collectCalls(std::set<Symbol>& callees) const {
+}
+
+void BinaryExprAST::collectCalls(std::set<Symbol>& callees) const {
+	m_left->collectCalls(callees);
+	m_right->collectCalls(callees);
+}
+
+void VarDefExprAST::collectCalls(std::set<Symbol>& callees) const {
+	for (auto& ass : m_varDeclDefs)
+		if (ass.second) ass.second->collectCalls(callees);
+	m_innerExpr->collectCalls(callees);
+}
+
+void IfThenElseExprAST::collectCalls(std::set<Symbol>& callees) const {
+	m_cond->collectCalls(callees);
+	m_thenExpr->collectCalls(callees);
+	m_elseExpr->collectCalls(callees);
+}
+
+void ForExprAST::collectCalls(std::set<Symbol>& callees) const {
+	m_init->collectCalls(callees);
+	m_cond->collectCalls(callees);
+	if (m_step) m_step->collectCalls(callees);
+	m_body->collectCalls(callees);
+}
+
+void WhileExprAST::collectCalls(std::set<Symbol>& callees) const {
+	m_cond->collectCalls(callees);
+	m_body->collectCalls(callees);
+}
+
+void CallExprAST::collectCalls(std::set<Symbol>& callees) const {
+	callees.insert(m_name);
+	for (auto e : m_exps)
+		e->collectCalls(callees);
+}
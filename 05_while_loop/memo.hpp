@@ -0,0 +1,81 @@
+#ifndef MEMO_HPP
+#define MEMO_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "symbols.hpp"
+
+/// Memoization of pure functions.
+///
+/// A function is pure if it only calls itself and other pure functions
+/// (externs like printd or putchard are not), so its result only depends on
+/// its arguments. 'def memo f(x)' memoizes f, -memo does it for every pure
+/// recursive function. The generated f looks its arguments up in a result
+/// cache of its own (a MemoTable) and only runs the body on a miss. Every
+/// self call goes through the cache too, self tail calls of the body
+/// included: they aren't turned into jumps.
+///
+/// Purity is decided when a function is defined: redefining one of its
+/// callees as impure later doesn't change it. Tables are only used from
+/// the thread running JITed code.
+
+class ExprAST;
+class FunctionAST;
+
+/// Open addressing result cache of one function, keyed on the bits of its
+/// double arguments. Linear probing looks at a few slots from the home slot
+/// of the arguments; when those are all taken, -memo-evict decides if the
+/// home slot is replaced or the result is dropped.
+class MemoTable {
+public:
+	/// 'capacity' is rounded up to a power of two.
+	MemoTable(std::string name, unsigned arity, size_t capacity, bool evict);
+
+	/// Stores the cached result of 'args' in 'result', returns false on a miss.
+	bool lookup(const double* args, double& result);
+	void insert(const double* args, double result);
+
+	/// Prints the hit rate.
+	void printStats(std::ostream& os) const;
+
+private:
+	MemoTable(const MemoTable&) = delete;
+	MemoTable& operator=(const MemoTable&) = delete;
+
+	size_t homeSlot(const double* args) const;
+	bool matches(size_t slot, const double* args) const;
+
+	std::string m_name;
+	unsigned m_arity;
+	size_t m_mask;
+	bool m_evict;
+	/// m_arity arguments per slot
+	std::vector<double> m_keys;
+	std::vector<double> m_results;
+	std::vector<uint8_t> m_used;
+
+	uint64_t m_hits, m_misses, m_evictions, m_dropped;
+};
+
+/// Decides if 'fun' is pure (and remembers it for its callers).
+/// If not, 'impureCallee' is set to a callee making it impure.
+bool checkPurity(const FunctionAST& fun, Symbol& impureCallee);
+
+/// Returns true if 'expr' only calls pure functions.
+bool isPureExpression(const ExprAST& expr);
+
+/// Returns a new table for a function (tables are never freed).
+MemoTable* newMemoTable(const std::string& name, unsigned arity);
+
+/// Prints the hit rates of all tables.
+void printMemoStatistics(std::ostream& os);
+
+/// Called by memoized functions.
+extern "C" int kal_memo_lookup(void* table, const double* args, double* result);
+extern "C" void kal_memo_insert(void* table, const double* args, double result);
+
+#endif /* ifndef MEMO_HPP */
@@ -0,0 +1,87 @@
+#include "objcache.hpp"
+#include "stats.hpp"
+
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace llvm;
+
+static Statistic NumHits("objcache", "objects loaded from the cache");
+static Statistic NumMisses("objcache", "objects not in the cache");
+static Statistic NumStored("objcache", "objects written to the cache");
+
+KaleidoscopeObjectCache::KaleidoscopeObjectCache(std::string cacheDir, std::string targetKey)
+	: m_cacheDir(cacheDir), m_targetKey(targetKey)
+{
+	if (std::error_code EC = sys::fs::create_directories(m_cacheDir))
+		errs() << "Can't create cache directory '" << m_cacheDir << "': " << EC.message() << "\n";
+}
+
+std::string KaleidoscopeObjectCache::cachePath(const Module* M) {
+	std::string IR;
+	raw_string_ostream IRStream(IR);
+	M->print(IRStream, nullptr);
+	IRStream.flush();
+
+	MD5 hash;
+	hash.update(m_targetKey);
+	hash.update(IR);
+	MD5::MD5Result result;
+	hash.final(result);
+	SmallString<32> hex;
+	MD5::stringifyResult(result, hex);
+
+	SmallString<128> path(m_cacheDir);
+	sys::path::append(path, hex.str() + ".o");
+	return path.str();
+}
+
+std::unique_ptr<MemoryBuffer> KaleidoscopeObjectCache::getObject(const Module* M) {
+	std::string path = cachePath(M);
+
+	auto buffer = MemoryBuffer::getFile(path);
+	if (! buffer) {
+		++NumMisses;
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_pendingPaths[M] = path;
+		return nullptr;
+	}
+	++NumHits;
+	// The JIT may write into the buffer, don't let it near the mapped file
+	return MemoryBuffer::getMemBufferCopy((*buffer)->getBuffer());
+}
+
+void KaleidoscopeObjectCache::notifyObjectCompiled(const Module* M, MemoryBufferRef obj) {
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		auto searchRes = m_pendingPaths.find(M);
+		if (searchRes == m_pendingPaths.end()) {
+			path = cachePath(M);
+		} else {
+			path = searchRes->second;
+			m_pendingPaths.erase(searchRes);
+		}
+	}
+
+	// Write to a temporary file first, another kaleidoscope may be
+	// reading the same cache.
+	int fd;
+	SmallString<128> tmpPath;
+	if (sys::fs::createUniqueFile(path + ".%%%%%%.tmp", fd, tmpPath)) {
+		errs() << "Can't write to cache directory '" << m_cacheDir << "'\n";
+		return;
+	}
+	{
+		raw_fd_ostream out(fd, true);
+		out << obj.getBuffer();
+	}
+	if (sys::fs::rename(tmpPath, path)) {
+		sys::fs::remove(tmpPath);
+		return;
+	}
+	++NumStored;
+}
@@ -0,0 +1,37 @@
+#ifndef OBJCACHE_HPP
+#define OBJCACHE_HPP
+
+#include "llvm/ExecutionEngine/ObjectCache.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/MemoryBuffer.h"
+
+#include <map>
+#include <mutex>
+#include <string>
+
+/// Keeps the object files the JIT emits in a directory (-cache-dir=<dir>).
+/// An object is keyed by the MD5 of the (optimized) IR of its module and of
+/// the target it was compiled for, so later runs load the object instead of
+/// running codegen for the same definitions again.
+class KaleidoscopeObjectCache : public llvm::ObjectCache {
+public:
+	/// 'targetKey' tells apart objects of different targets (triple, cpu, features).
+	KaleidoscopeObjectCache(std::string cacheDir, std::string targetKey);
+
+	void notifyObjectCompiled(const llvm::Module* M, llvm::MemoryBufferRef obj) override;
+	std::unique_ptr<llvm::MemoryBuffer> getObject(const llvm::Module* M) override;
+
+private:
+	/// Path of the cache file of 'M'
+	std::string cachePath(const llvm::Module* M);
+
+	std::string m_cacheDir;
+	std::string m_targetKey;
+
+	/// Paths computed by getObject() for modules being compiled now,
+	/// so notifyObjectCompiled() doesn't print and hash the IR again.
+	std::map<const llvm::Module*, std::string> m_pendingPaths;
+	std::mutex m_mutex;
+};
+
+#endif /* ifndef OBJCACHE_HPP */
@@ -0,0 +1,172 @@
+#include "options.hpp"
+
+#include <cstdlib>
+#include <iostream>
+
+Options TheOptions;
+
+static void printUsage(const char* prog) {
+	std::cerr << "Usage: " << prog << " [options] [file.kal]\n"
+		<< "  -O0 -O1 -O2 -O3  optimization level of the function pipeline (default -O0)\n"
+		<< "  -ipo=<n>         optimization level (0-3) of the module pipeline run\n"
+		<< "                   before a module goes to the JIT (default 0)\n"
+		<< "  -q               don't dump the generated IR\n"
+		<< "  -time            report execution time of top-level expressions\n"
+		<< "  -mem             report resident and JIT memory after every top-level\n"
+		<< "                   expression\n"
+		<< "  -time-passes     report time spent in the function and module pipelines\n"
+		<< "  -tiered          compile functions at -O0 first, recompile hot ones at -O3\n"
+		<< "  -tier-threshold=<n>  calls plus loop back edges after which a function\n"
+		<< "                   is hot (default 10000)\n"
+		<< "  -batch=<n>       compile up to <n> consecutive top-level expressions\n"
+		<< "                   into one module (run in order once it is full)\n"
+		<< "  -expr-cache=<n>  keep up to <n> compiled top-level expressions to run\n"
+		<< "                   repeats of them without compiling (pure ones not at all)\n"
+		<< "  -interp          interpret top-level expressions without loops instead of\n"
+		<< "                   compiling them (-interp=always: all of them)\n"
+		<< "  -interp-ast=<a>  interpret the 'flat' AST (default) or the syntax 'tree'\n"
+		<< "  -lazy            compile every function on its first call\n"
+		<< "  -jobs=<n>        compile definitions on <n> background threads\n"
+		<< "  -cache-dir=<dir> keep compiled objects in <dir> and reuse them in later runs\n"
+		<< "  -ffast-math      reassociate floating point math everywhere\n"
+		<< "                   (like 'def fast' does for one function)\n"
+		<< "  -ssa             build SSA form during codegen instead of using allocas\n"
+		<< "  -infer-types     use i64 and i1 where values are integers and booleans\n"
+		<< "                   (int bodies check for results outside +-2^53 and\n"
+		<< "                   rerun in doubles)\n"
+		<< "  -memo            cache the results of every pure recursive function\n"
+		<< "                   (like 'def memo' does for one function)\n"
+		<< "  -memo-capacity=<n>  entries of each result cache (default 4096)\n"
+		<< "  -memo-evict=<p>  when a cache is full 'replace' an old result (default)\n"
+		<< "                   or 'keep' the old ones and drop the new one\n"
+		<< "  -stats           print statistics at exit\n"
+		<< "  -parse-only      only parse the program, don't compile or run anything\n"
+		<< "  -lex-only        only split the program into tokens, and report the\n"
+		<< "                   lexing throughput\n"
+		<< "  -aot=<base>      don't run anything, compile the definitions into\n"
+		<< "                   <base>.o, <base>.so and the C header <base>.h\n"
+		<< "  -mcpu=<cpu>      generate code for <cpu> (default: the host CPU,\n"
+		<< "                   'generic' for a baseline)\n"
+		<< "  -mattr=<+f,-f>   enable (+) or disable (-) target features\n"
+		<< "  -h               show this message" << std::endl;
+}
+
+bool parseOptions(int argc, char* argv[]) {
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+
+		if (arg.size() == 3 && arg[0] == '-' && arg[1] == 'O' && arg[2] >= '0' && arg[2] <= '3') {
+			TheOptions.optLevel = arg[2] - '0';
+		} else if (arg.size() == 6 && arg.compare(0, 5, "-ipo=") == 0 && arg[5] >= '0' && arg[5] <= '3') {
+			TheOptions.ipoLevel = arg[5] - '0';
+		} else if (arg == "-q") {
+			TheOptions.quiet = true;
+		} else if (arg == "-time") {
+			TheOptions.time = true;
+		} else if (arg == "-mem") {
+			TheOptions.memReport = true;
+		} else if (arg == "-time-passes") {
+			TheOptions.timePasses = true;
+		} else if (arg == "-tiered") {
+			TheOptions.tiered = true;
+		} else if (arg.compare(0, 16, "-tier-threshold=") == 0 && arg.size() > 16) {
+			char* end;
+			TheOptions.tierThreshold = strtoul(arg.c_str() + 16, &end, 10);
+			if (*end != '\0' || TheOptions.tierThreshold == 0) {
+				std::cerr << "Bad tier threshold: '" << arg << "'" << std::endl;
+				return false;
+			}
+		} else if (arg.compare(0, 7, "-batch=") == 0 && arg.size() > 7) {
+			char* end;
+			TheOptions.batch = strtoul(arg.c_str() + 7, &end, 10);
+			if (*end != '\0') {
+				std::cerr << "Bad batch size: '" << arg << "'" << std::endl;
+				return false;
+			}
+		} else if (arg.compare(0, 12, "-expr-cache=") == 0 && arg.size() > 12) {
+			char* end;
+			TheOptions.exprCache = strtoul(arg.c_str() + 12, &end, 10);
+			if (*end != '\0') {
+				std::cerr << "Bad expression cache size: '" << arg << "'" << std::endl;
+				return false;
+			}
+		} else if (arg == "-interp") {
+			TheOptions.interp = true;
+		} else if (arg == "-interp=always") {
+			TheOptions.interp = TheOptions.interpAlways = true;
+		} else if (arg == "-interp-ast=flat") {
+			TheOptions.interpTree = false;
+		} else if (arg == "-interp-ast=tree") {
+			TheOptions.interpTree = true;
+		} else if (arg == "-lazy") {
+			TheOptions.lazy = true;
+		} else if (arg.compare(0, 6, "-jobs=") == 0 && arg.size() > 6) {
+			char* end;
+			TheOptions.jobs = strtoul(arg.c_str() + 6, &end, 10);
+			if (*end != '\0') {
+				std::cerr << "Bad number of jobs: '" << arg << "'" << std::endl;
+				return false;
+			}
+		} else if (arg.compare(0, 11, "-cache-dir=") == 0 && arg.size() > 11) {
+			TheOptions.cacheDir = arg.substr(11);
+		} else if (arg == "-ffast-math") {
+			TheOptions.fastMath = true;
+		} else if (arg == "-ssa") {
+			TheOptions.ssa = true;
+		} else if (arg == "-infer-types") {
+			TheOptions.inferTypes = true;
+		} else if (arg == "-memo") {
+			TheOptions.memo = true;
+		} else if (arg.compare(0, 15, "-memo-capacity=") == 0 && arg.size() > 15) {
+			char* end;
+			TheOptions.memoCapacity = strtoul(arg.c_str() + 15, &end, 10);
+			if (*end != '\0' || TheOptions.memoCapacity == 0) {
+				std::cerr << "Bad memo capacity: '" << arg << "'" << std::endl;
+				return false;
+			}
+		} else if (arg == "-memo-evict=replace") {
+			TheOptions.memoEvict = true;
+		} else if (arg == "-memo-evict=keep") {
+			TheOptions.memoEvict = false;
+		} else if (arg == "-stats") {
+			TheOptions.stats = true;
+		} else if (arg == "-parse-only") {
+			TheOptions.parseOnly = true;
+		} else if (arg == "-lex-only") {
+			TheOptions.lexOnly = true;
+		} else if (arg.compare(0, 5, "-aot=") == 0 && arg.size() > 5) {
+			TheOptions.aotBase = arg.substr(5);
+		} else if (arg.compare(0, 6, "-mcpu=") == 0 && arg.size() > 6) {
+			TheOptions.cpu = arg.substr(6);
+		} else if (arg.compare(0, 7, "-mattr=") == 0 && arg.size() > 7) {
+			std::string::size_type begin = 7, end;
+			do {
+				end = arg.find(',', begin);
+				std::string feature = arg.substr(begin, end == std::string::npos ? end : end - begin);
+				if (feature.size() < 2 || (feature[0] != '+' && feature[0] != '-')) {
+					std::cerr << "Bad target feature: '" << feature << "' (use +feature or -feature)" << std::endl;
+					return false;
+				}
+				TheOptions.features.push_back(feature);
+				begin = end + 1;
+			} while (end != std::string::npos);
+		} else if (arg == "-h" || arg == "--help") {
+			printUsage(argv[0]);
+			return false;
+		} else if (arg[0] != '-' && TheOptions.inputFile.empty()) {
+			TheOptions.inputFile = arg;
+		} else {
+			std::cerr << "Unknown option: '" << arg << "'" << std::endl;
+			printUsage(argv[0]);
+			return false;
+		}
+	}
+
+	if (! TheOptions.aotBase.empty() && (TheOptions.tiered || TheOptions.lazy || TheOptions.jobs)) {
+		// All definitions have to end up in one module
+		std::cerr << "; -aot compiles eagerly, ignoring -tiered, -lazy and -jobs" << std::endl;
+		TheOptions.tiered = TheOptions.lazy = false;
+		TheOptions.jobs = 0;
+	}
+	return true;
+}
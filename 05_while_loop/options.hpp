@@ -0,0 +1,92 @@
+#ifndef OPTIONS_HPP
+#define OPTIONS_HPP
+
+#include <string>
+#include <vector>
+
+/// Command line options of the kaleidoscope driver.
+struct Options {
+	Options()
+		: optLevel(0), ipoLevel(0), quiet(false), time(false), memReport(false), timePasses(false),
+		  tiered(false), tierThreshold(10000), batch(0), exprCache(0),
+		  interp(false), interpAlways(false), interpTree(false), lazy(false),
+		  jobs(0), stats(false), fastMath(false), ssa(false), inferTypes(false),
+		  memo(false), memoCapacity(4096), memoEvict(true), parseOnly(false), lexOnly(false)
+	{}
+
+	/// Optimization level of the per-function pipeline (-O0, -O1, -O2, -O3).
+	unsigned optLevel;
+	/// Optimization level of the module (interprocedural) pipeline (-ipo=<n>).
+	unsigned ipoLevel;
+	/// Don't dump the generated IR (-q).
+	bool quiet;
+	/// Report how long every top-level expression took to run (-time).
+	bool time;
+	/// Report resident memory and the memory of JITed code after every
+	/// top-level expression (-mem).
+	bool memReport;
+	/// Report how long the function and module pipelines took (-time-passes).
+	bool timePasses;
+	/// Compile at -O0 first and recompile hot functions at -O3 (-tiered).
+	bool tiered;
+	/// Calls plus loop back edges after which a function is hot (-tier-threshold=<n>).
+	unsigned long tierThreshold;
+	/// Consecutive top-level expressions compiled into one module, 0 or 1
+	/// to compile each on its own (-batch=<n>).
+	unsigned batch;
+	/// Compiled top-level expressions kept for repeats of them, 0 for no
+	/// cache (-expr-cache=<n>).
+	unsigned long exprCache;
+	/// Interpret top-level expressions without loops instead of compiling
+	/// them (-interp), or all of them (-interp=always), see interp.hpp.
+	bool interp;
+	bool interpAlways;
+	/// Interpret the syntax tree instead of its flat form (-interp-ast=tree).
+	bool interpTree;
+	/// Compile every function on its first call (-lazy).
+	bool lazy;
+	/// Worker threads compiling definitions in the background, 0 for none (-jobs=<n>).
+	unsigned jobs;
+	/// Directory of the object cache, no cache if empty (-cache-dir=<dir>).
+	std::string cacheDir;
+	/// Print the statistics counters at exit (-stats).
+	bool stats;
+	/// Let every function reassociate floating point math (-ffast-math),
+	/// 'def fast' does it for one function.
+	bool fastMath;
+	/// Generate SSA values and PHIs for variables instead of allocas (-ssa).
+	bool ssa;
+	/// Type values as bools, ints and doubles instead of doubles only (-infer-types).
+	bool inferTypes;
+	/// Memoize every pure recursive function (-memo), 'def memo' does it
+	/// for one pure function.
+	bool memo;
+	/// Entries of the result cache of a memoized function, rounded up to a
+	/// power of two (-memo-capacity=<n>).
+	unsigned long memoCapacity;
+	/// Replace a cached result when there is no room for a new one, instead
+	/// of dropping the new one (-memo-evict=replace|keep).
+	bool memoEvict;
+	/// Only parse the program, without compiling or running anything (-parse-only).
+	bool parseOnly;
+	/// Only split the program into tokens and report how fast (-lex-only).
+	bool lexOnly;
+	/// Write <base>.o, <base>.so and <base>.h instead of running anything,
+	/// empty for the JIT (-aot=<base>).
+	std::string aotBase;
+	/// CPU to generate code for, the host CPU if empty (-mcpu=<cpu>).
+	std::string cpu;
+	/// Target features enabled ("+avx2") or disabled ("-fma") on top of
+	/// those of the CPU (-mattr=<features>).
+	std::vector<std::string> features;
+	/// File to read the program from, stdin if empty.
+	std::string inputFile;
+};
+
+extern Options TheOptions;
+
+/// Fills TheOptions from the command line.
+/// Returns false (after printing the usage) if the command line is bad.
+bool parseOptions(int argc, char* argv[]);
+
+#endif /* ifndef OPTIONS_HPP */
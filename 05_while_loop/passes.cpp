@@ -0,0 +1,63 @@
+#include "passes.hpp"
+
+#include "llvm/Transforms/IPO.h"
+#include "llvm/Transforms/Scalar.h"
+#include "llvm/Transforms/Scalar/GVN.h"
+#include "llvm/Transforms/Vectorize.h"
+
+using namespace llvm;
+
+void addFunctionPasses(legacy::FunctionPassManager& FPM, unsigned optLevel) {
+	if (optLevel == 0) return;
+
+	// Every variable lives in an alloca (see CreateEntryBlockAlloca),
+	// so the first thing to do is to put them back into registers.
+	FPM.add(createPromoteMemoryToRegisterPass());
+	FPM.add(createInstructionCombiningPass());
+	FPM.add(createCFGSimplificationPass());
+	if (optLevel == 1) return;
+
+	FPM.add(createReassociatePass());
+	FPM.add(createEarlyCSEPass());
+	FPM.add(createGVNPass());
+	FPM.add(createCFGSimplificationPass());
+
+	// Loop passes (loop-simplify and lcssa get scheduled on their own)
+	FPM.add(createLoopRotatePass());
+	FPM.add(createLICMPass());
+	FPM.add(createIndVarSimplifyPass());
+	FPM.add(createLoopDeletionPass());
+	if (optLevel >= 3) {
+		// Reductions only vectorize when their math may be reassociated
+		// (fast-math), see FunctionAST::codegen()
+		FPM.add(createLoopVectorizePass());
+		FPM.add(createSLPVectorizerPass());
+		FPM.add(createLoopUnrollPass());
+		FPM.add(createGVNPass());
+	}
+
+	// Clean up what the loop passes left behind
+	FPM.add(createInstructionCombiningPass());
+	FPM.add(createCFGSimplificationPass());
+}
+
+void addModulePasses(legacy::PassManager& MPM, unsigned ipoLevel) {
+	if (ipoLevel == 0) return;
+
+	MPM.add(createIPSCCPPass());
+	MPM.add(createDeadArgEliminationPass());
+	if (ipoLevel >= 2) {
+		MPM.add(createFunctionInliningPass(ipoLevel, 0));
+		// The inlined bodies still need the function pipeline
+		MPM.add(createPromoteMemoryToRegisterPass());
+		MPM.add(createInstructionCombiningPass());
+		MPM.add(createReassociatePass());
+		MPM.add(createGVNPass());
+		MPM.add(createCFGSimplificationPass());
+	}
+	if (ipoLevel >= 3) MPM.add(createGlobalOptimizerPass());
+
+	// Whatever didn't get inlined is already compiled in another module
+	MPM.add(createEliminateAvailableExternallyPass());
+	MPM.add(createGlobalDCEPass());
+}
@@ -0,0 +1,17 @@
+#ifndef PASSES_HPP
+#define PASSES_HPP
+
+#include "llvm/IR/LegacyPassManager.h"
+
+/// Fills the per-function pipeline for the given optimization level.
+/// -O0 adds nothing, -O1 cleans up the allocas, -O2 adds scalar and loop
+/// optimizations and -O3 additionally vectorizes and unrolls loops.
+void addFunctionPasses(llvm::legacy::FunctionPassManager& FPM, unsigned optLevel);
+
+/// Fills the module pipeline for the given optimization level.
+/// -ipo=1 runs IPSCCP, dead argument elimination and globaldce, -ipo=2 adds
+/// the inliner (and cleans up after it) and -ipo=3 inlines more aggressively.
+/// Callee bodies imported as available_externally are dropped at the end.
+void addModulePasses(llvm::legacy::PassManager& MPM, unsigned ipoLevel);
+
+#endif /* ifndef PASSES_HPP */
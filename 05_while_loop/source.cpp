@@ -0,0 +1,82 @@
+#include "source.hpp"
+#include "stats.hpp"
+
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+static Statistic NumMapped("source", "bytes of source mapped");
+static Statistic NumSlowNumbers("source", "number literals parsed by strtod()");
+
+SourceFile::~SourceFile() {
+	if (m_data) munmap(m_data, m_length);
+}
+
+bool SourceFile::map(const std::string& path) {
+	int fd = open(path.c_str(), O_RDONLY);
+	if (fd < 0) return false;
+	struct stat st;
+	// Empty files can't be mapped, and the rest needs a size
+	if (fstat(fd, &st) != 0 || ! S_ISREG(st.st_mode) || st.st_size == 0) {
+		close(fd);
+		return false;
+	}
+
+	// Zeroed pages with the file over them: past its end, in its last page
+	// or the next one, there are the NULs for flex
+	const size_t size = st.st_size;
+	const size_t page = sysconf(_SC_PAGESIZE);
+	const size_t length = (size + 2 + page - 1) / page * page;
+	void* base = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (base == MAP_FAILED) {
+		close(fd);
+		return false;
+	}
+	void* file = mmap(base, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_FIXED, fd, 0);
+	close(fd);
+	if (file == MAP_FAILED) {
+		munmap(base, length);
+		return false;
+	}
+	// Read front to back, once
+	madvise(base, size, MADV_SEQUENTIAL);
+
+	m_data = static_cast<char*>(base);
+	m_size = size;
+	m_length = length;
+	NumMapped += size;
+	return true;
+}
+
+/// Powers of ten exact in a double
+static const double PowersOfTen[] = {
+	1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+	1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+double parseNumber(const char* s, size_t len) {
+	uint64_t mantissa = 0;
+	unsigned digits = 0;
+	unsigned fraction = 0;
+	bool dot = false;
+	for (size_t i = 0; i < len; ++i) {
+		if (s[i] == '.') {
+			dot = true;
+			continue;
+		}
+		mantissa = mantissa * 10 + (s[i] - '0');
+		++digits;
+		if (dot) ++fraction;
+	}
+
+	// 19 digits can't overflow; below 2^53 the mantissa is an exact double,
+	// and so is 10^fraction, so one division rounds correctly
+	if (digits <= 19 && mantissa <= (UINT64_C(1) << 53) && fraction <= 22)
+		return (double)mantissa / PowersOfTen[fraction];
+
+	++NumSlowNumbers;
+	return std::strtod(std::string(s, len).c_str(), nullptr);
+}
@@ -0,0 +1,49 @@
+#ifndef SOURCE_HPP
+#define SOURCE_HPP
+
+#include <cstddef>
+#include <string>
+
+/// Lexer input.
+///
+/// A program given as a file is mapped into memory and flex scans the
+/// mapping in place (yy_scan_buffer), without read() calls or copies into
+/// buffers of its own: yytext points into the mapping, identifiers are
+/// interned from there and numbers parsed from there. Other input (stdin,
+/// pipes, empty files) goes through the default flex buffering.
+
+/// A source file mapped into memory, followed by the two NULs flex wants
+/// at the end of a buffer. The mapping is private: flex writes its end of
+/// token NULs into it, never into the file.
+class SourceFile {
+public:
+	SourceFile() : m_data(nullptr), m_size(0), m_length(0) {}
+	~SourceFile();
+
+	/// Maps 'path'. Returns false (with nothing mapped) if it isn't a
+	/// regular file or can't be mapped, for the caller to read it instead.
+	bool map(const std::string& path);
+
+	char* data() const { return m_data; }
+	/// Bytes of the file (without the NULs)
+	size_t size() const { return m_size; }
+
+private:
+	SourceFile(const SourceFile&) = delete;
+	SourceFile& operator=(const SourceFile&) = delete;
+
+	char* m_data;
+	size_t m_size;
+	/// Bytes mapped, whole pages
+	size_t m_length;
+};
+
+/// Makes the lexer scan 'source' (in lexer.lex).
+void scanSource(SourceFile& source);
+
+/// Value of the number literal 's' ('len' digits with at most one '.').
+/// Exact digits and powers of ten are combined in one correctly rounded
+/// operation; longer literals go through strtod().
+double parseNumber(const char* s, size_t len);
+
+#endif /* ifndef SOURCE_HPP */
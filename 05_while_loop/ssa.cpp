@@ -0,0 +1,112 @@
+#include "ssa.hpp"
+#include "stats.hpp"
+
+#include "llvm/IR/CFG.h"
+#include "llvm/IR/Constants.h"
+#include "llvm/IR/ValueHandle.h"
+
+using namespace llvm;
+
+static Statistic NumPhis("ssa", "PHI nodes placed for variables");
+static Statistic NumTrivialPhis("ssa", "trivial PHI nodes removed");
+
+void SSABuilder::clear() {
+	m_variables.clear();
+	m_sealed.clear();
+	m_incompletePhis.clear();
+}
+
+unsigned SSABuilder::newVariable(const std::string& name, Type* type) {
+	m_variables.push_back(Variable());
+	m_variables.back().name = name;
+	m_variables.back().type = type;
+	return m_variables.size() - 1;
+}
+
+void SSABuilder::writeVariable(unsigned var, BasicBlock* block, Value* value) {
+	m_variables[var].defs[block] = value;
+}
+
+Value* SSABuilder::readVariable(unsigned var, BasicBlock* block) {
+	auto& defs = m_variables[var].defs;
+	auto found = defs.find(block);
+	if (found != defs.end()) return found->second;
+	return readVariableRecursive(var, block);
+}
+
+Value* SSABuilder::readVariableRecursive(unsigned var, BasicBlock* block) {
+	Value* value;
+	if (! m_sealed.count(block)) {
+		// Not every predecessor is there yet, sealBlock() adds the operands
+		PHINode* phi = newPhi(var, block);
+		m_incompletePhis[block].push_back(std::make_pair(var, phi));
+		value = phi;
+	} else if (BasicBlock* pred = block->getSinglePredecessor()) {
+		// No PHI needed
+		value = readVariable(var, pred);
+	} else if (pred_begin(block) == pred_end(block)) {
+		// Read before any write
+		value = UndefValue::get(m_variables[var].type);
+	} else {
+		// The PHI goes in first, so loops end up reading it
+		PHINode* phi = newPhi(var, block);
+		writeVariable(var, block, phi);
+		value = addPhiOperands(var, phi);
+	}
+	writeVariable(var, block, value);
+	return value;
+}
+
+PHINode* SSABuilder::newPhi(unsigned var, BasicBlock* block) {
+	++NumPhis;
+	const Variable& v = m_variables[var];
+	if (block->empty()) return PHINode::Create(v.type, 0, v.name, block);
+	return PHINode::Create(v.type, 0, v.name, &block->front());
+}
+
+Value* SSABuilder::addPhiOperands(unsigned var, PHINode* phi) {
+	for (BasicBlock* pred : predecessors(phi->getParent()))
+		phi->addIncoming(readVariable(var, pred), pred);
+	return tryRemoveTrivialPhi(phi);
+}
+
+Value* SSABuilder::tryRemoveTrivialPhi(PHINode* phi) {
+	Value* same = nullptr;
+	for (Value* op : phi->incoming_values()) {
+		// Unique value or a reference to itself
+		if (op == same || op == phi) continue;
+		// Merges at least two values: not trivial
+		if (same) return phi;
+		same = op;
+	}
+	// Unreachable or in the entry block
+	if (! same) same = UndefValue::get(phi->getType());
+
+	// Removing this PHI may make the PHIs using it trivial too.
+	// Those may go away while we're at it, hence the weak handles.
+	std::vector<WeakVH> users;
+	for (User* user : phi->users())
+		if (user != phi && isa<PHINode>(user)) users.push_back(WeakVH(user));
+
+	phi->replaceAllUsesWith(same);
+	for (auto& v : m_variables)
+		for (auto& def : v.defs)
+			if (def.second == phi) def.second = same;
+	phi->eraseFromParent();
+	++NumTrivialPhis;
+
+	for (auto& user : users)
+		if (user) tryRemoveTrivialPhi(cast<PHINode>(user));
+	return same;
+}
+
+void SSABuilder::sealBlock(BasicBlock* block) {
+	auto found = m_incompletePhis.find(block);
+	if (found != m_incompletePhis.end()) {
+		// Operands may create new incomplete PHIs elsewhere, so move these out first
+		auto phis = std::move(found->second);
+		m_incompletePhis.erase(found);
+		for (auto& phi : phis) addPhiOperands(phi.first, phi.second);
+	}
+	m_sealed.insert(block);
+}
@@ -0,0 +1,56 @@
+#ifndef SSA_HPP
+#define SSA_HPP
+
+#include "llvm/IR/BasicBlock.h"
+#include "llvm/IR/Instructions.h"
+
+#include <map>
+#include <set>
+#include <string>
+#include <utility>
+#include <vector>
+
+/// Builds SSA form while the code is generated (-ssa), following Braun et
+/// al., "Simple and Efficient Construction of Static Single Assignment Form".
+///
+/// Every variable keeps its current value per basic block. Reading it in a
+/// block without a definition looks through the predecessors and places
+/// PHI nodes where values meet. A block is "sealed" once all of its
+/// predecessors are known; reads in a block which isn't sealed yet get an
+/// operandless PHI which is completed when the block gets sealed. PHIs with
+/// a single distinct operand are removed right away.
+class SSABuilder {
+public:
+	/// Forgets everything, called at the start of every function.
+	void clear();
+
+	/// Returns the id of a new variable.
+	unsigned newVariable(const std::string& name, llvm::Type* type);
+
+	void writeVariable(unsigned var, llvm::BasicBlock* block, llvm::Value* value);
+	llvm::Value* readVariable(unsigned var, llvm::BasicBlock* block);
+
+	/// Tells that every predecessor of 'block' is known (its terminator
+	/// is emitted).
+	void sealBlock(llvm::BasicBlock* block);
+
+private:
+	struct Variable {
+		std::string name;
+		llvm::Type* type;
+		/// Current value in every block it was read or written in
+		std::map<llvm::BasicBlock*, llvm::Value*> defs;
+	};
+
+	llvm::Value* readVariableRecursive(unsigned var, llvm::BasicBlock* block);
+	llvm::PHINode* newPhi(unsigned var, llvm::BasicBlock* block);
+	llvm::Value* addPhiOperands(unsigned var, llvm::PHINode* phi);
+	llvm::Value* tryRemoveTrivialPhi(llvm::PHINode* phi);
+
+	std::vector<Variable> m_variables;
+	std::set<llvm::BasicBlock*> m_sealed;
+	/// PHIs waiting for their block to be sealed
+	std::map<llvm::BasicBlock*, std::vector<std::pair<unsigned, llvm::PHINode*> > > m_incompletePhis;
+};
+
+#endif /* ifndef SSA_HPP */
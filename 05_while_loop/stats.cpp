@@ -0,0 +1,27 @@
+#include "stats.hpp"
+
+#include <iomanip>
+#include <vector>
+
+/// All counters, in order of construction.
+/// (A function static, so it exists before the first counter does.)
+static std::vector<const Statistic*>& statistics() {
+	static std::vector<const Statistic*> all;
+	return all;
+}
+
+Statistic::Statistic(const char* group, const char* desc)
+	: m_group(group), m_desc(desc), m_value(0)
+{
+	statistics().push_back(this);
+}
+
+void printStatistics(std::ostream& os) {
+	os << "; ==== Statistics ====" << std::endl;
+	for (auto stat : statistics()) {
+		if (stat->value() == 0) continue;
+		os << ";" << std::setw(12) << stat->value() << "  "
+			<< std::left << std::setw(10) << stat->group() << std::right
+			<< stat->desc() << std::endl;
+	}
+}
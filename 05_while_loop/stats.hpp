@@ -0,0 +1,34 @@
+#ifndef STATS_HPP
+#define STATS_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+
+/// A counter printed at exit with -stats.
+/// Define one per event at file scope, ex.
+///     static Statistic NumHits("objcache", "objects loaded from the cache");
+class Statistic {
+public:
+	Statistic(const char* group, const char* desc);
+
+	Statistic& operator++() { ++m_value; return *this; }
+	Statistic& operator+=(uint64_t n) { m_value += n; return *this; }
+	uint64_t value() const { return m_value; }
+
+	const char* group() const { return m_group; }
+	const char* desc() const { return m_desc; }
+
+private:
+	Statistic(const Statistic&) = delete;
+	Statistic& operator=(const Statistic&) = delete;
+
+	const char* m_group;
+	const char* m_desc;
+	std::atomic<uint64_t> m_value;
+};
+
+/// Prints every counter that isn't zero.
+void printStatistics(std::ostream& os);
+
+#endif /* ifndef STATS_HPP */
@@ -0,0 +1,66 @@
+#include "symbols.hpp"
+#include "stats.hpp"
+
+#include "llvm/ADT/StringMap.h"
+#include "llvm/Support/ErrorHandling.h"
+
+#include <memory>
+#include <mutex>
+
+static Statistic NumSymbols("symbols", "identifiers interned");
+static Statistic NumInterned("symbols", "identifiers looked up in the interner");
+
+namespace {
+/// The names by id, in chunks which never move once allocated: str() reads
+/// them without the lock. A thread only gets to see an id after it was
+/// handed over (with the syntax tree, through a lock), so its chunk is there.
+const unsigned ChunkBits = 12;
+const uint32_t ChunkSize = 1 << ChunkBits;
+const uint32_t MaxChunks = 1 << 14;
+
+class SymbolTable {
+public:
+	/// Id 0 is the empty name of Symbol()
+	SymbolTable() : m_size(1) {
+		m_ids.insert(std::make_pair("", 0));
+		m_chunks[0].reset(new std::string[ChunkSize]);
+	}
+
+	uint32_t intern(llvm::StringRef name) {
+		std::lock_guard<std::mutex> lock(m_mutex);
+		++NumInterned;
+		auto inserted = m_ids.insert(std::make_pair(name, m_size));
+		if (! inserted.second) return inserted.first->second;
+
+		if (m_size == MaxChunks * ChunkSize) llvm::report_fatal_error("Too many identifiers");
+		if (m_size % ChunkSize == 0) m_chunks[m_size >> ChunkBits].reset(new std::string[ChunkSize]);
+		m_chunks[m_size >> ChunkBits][m_size & (ChunkSize - 1)] = name.str();
+		++NumSymbols;
+		return m_size++;
+	}
+
+	const std::string& str(uint32_t id) const {
+		return m_chunks[id >> ChunkBits][id & (ChunkSize - 1)];
+	}
+
+private:
+	std::mutex m_mutex;
+	llvm::StringMap<uint32_t> m_ids;
+	std::unique_ptr<std::string[]> m_chunks[MaxChunks];
+	uint32_t m_size;
+};
+}
+
+/// Built on first use
+static SymbolTable& symbolTable() {
+	static SymbolTable table;
+	return table;
+}
+
+Symbol Symbol::intern(llvm::StringRef name) {
+	return Symbol(symbolTable().intern(name));
+}
+
+const std::string& Symbol::str() const {
+	return symbolTable().str(m_id);
+}
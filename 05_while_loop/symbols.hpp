@@ -0,0 +1,52 @@
+#ifndef SYMBOLS_HPP
+#define SYMBOLS_HPP
+
+#include <cstdint>
+#include <functional>
+#include <iostream>
+#include <string>
+
+#include "llvm/ADT/StringRef.h"
+
+/// Interned identifiers.
+///
+/// The lexer interns every identifier it reads: equal names get the same
+/// 32-bit id, so from the parser on names are copied, compared and hashed
+/// as integers. The text of a name is only looked up where it's needed, for
+/// LLVM names and error messages. Names are never freed.
+class Symbol {
+public:
+	/// The empty name, id 0 (no identifier is empty, so it is never one)
+	Symbol() : m_id(0) {}
+
+	/// Returns the symbol called 'name', interning it on first use
+	/// (thread safe).
+	static Symbol intern(llvm::StringRef name);
+
+	uint32_t id() const { return m_id; }
+	/// The name of the symbol (no lock needed, it never moves).
+	const std::string& str() const;
+
+	bool operator==(Symbol other) const { return m_id == other.m_id; }
+	bool operator!=(Symbol other) const { return m_id != other.m_id; }
+	/// Orders by id (not by name)
+	bool operator<(Symbol other) const { return m_id < other.m_id; }
+
+private:
+	explicit Symbol(uint32_t id) : m_id(id) {}
+
+	uint32_t m_id;
+};
+
+inline std::ostream& operator<<(std::ostream& os, Symbol sym) {
+	return os << sym.str();
+}
+
+namespace std {
+	/// Ids are dense already
+	template <> struct hash<Symbol> {
+		size_t operator()(Symbol sym) const { return sym.id(); }
+	};
+}
+
+#endif /* ifndef SYMBOLS_HPP */
@@ -0,0 +1,123 @@
+#ifndef SYMTAB_HPP
+#define SYMTAB_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "symbols.hpp"
+
+/// Variables in scope during codegen, by symbol.
+///
+/// An open addressing table (linear probing, power of two capacity) keyed
+/// on symbol ids, plus an undo log: bind() notes what the symbol was bound
+/// to before, and leaving a scope replays the log back to the mark taken
+/// when the scope was entered. Entering a scope is O(1), leaving it is O(1)
+/// per binding made in it, and shadowed bindings come back in the right
+/// order however often a name is rebound. clear() bumps an epoch instead of
+/// touching the slots, so starting a function is O(1) too.
+template <typename V>
+class ScopedSymbolTable {
+public:
+	ScopedSymbolTable() : m_slots(16), m_used(0), m_epoch(1) {}
+
+	/// Returns the value bound to 'sym' (nullptr if it is unbound).
+	const V* lookup(Symbol sym) const {
+		const Slot& slot = m_slots[find(sym)];
+		return slot.epoch == m_epoch && slot.bound ? &slot.value : nullptr;
+	}
+
+	/// Binds 'sym' to 'value' until the scope it was bound in is left.
+	void bind(Symbol sym, V value) {
+		Slot& slot = claim(sym);
+		m_undo.push_back(Undo{sym, slot.value, slot.bound});
+		slot.value = value;
+		slot.bound = true;
+	}
+
+	/// Returns a mark for leaveScope().
+	size_t enterScope() const { return m_undo.size(); }
+	/// Undoes every bind() since 'mark', newest first.
+	void leaveScope(size_t mark) {
+		while (m_undo.size() > mark) {
+			const Undo& undo = m_undo.back();
+			Slot& slot = m_slots[find(undo.sym)];
+			slot.value = undo.value;
+			slot.bound = undo.bound;
+			m_undo.pop_back();
+		}
+	}
+
+	/// Unbinds every symbol.
+	void clear() {
+		m_undo.clear();
+		m_used = 0;
+		if (++m_epoch == 0) {
+			// Wrapped around: free every slot for real
+			m_slots.assign(m_slots.size(), Slot());
+			m_epoch = 1;
+		}
+	}
+
+private:
+	struct Slot {
+		Slot() : epoch(0), bound(false), value() {}
+		Symbol sym;
+		/// Slots of an older epoch are free
+		uint32_t epoch;
+		bool bound;
+		V value;
+	};
+	struct Undo {
+		Symbol sym;
+		V value;
+		bool bound;
+	};
+
+	/// Returns the slot of 'sym', or the free slot where it would go.
+	size_t find(Symbol sym) const {
+		const size_t mask = m_slots.size() - 1;
+		// An odd multiplier spreads consecutive ids over the table
+		size_t i = (sym.id() * 2654435769u) & mask;
+		while (m_slots[i].epoch == m_epoch && m_slots[i].sym != sym)
+			i = (i + 1) & mask;
+		return i;
+	}
+
+	/// Returns the slot of 'sym', taking a free one if it has none.
+	/// A symbol keeps its slot until clear(), bound or not, so there are
+	/// no tombstones.
+	Slot& claim(Symbol sym) {
+		size_t i = find(sym);
+		if (m_slots[i].epoch == m_epoch) return m_slots[i];
+		if ((m_used + 1) * 4 > m_slots.size() * 3) {
+			grow();
+			i = find(sym);
+		}
+		++m_used;
+		Slot& slot = m_slots[i];
+		slot.sym = sym;
+		slot.epoch = m_epoch;
+		slot.bound = false;
+		slot.value = V();
+		return slot;
+	}
+
+	void grow() {
+		std::vector<Slot> old;
+		old.swap(m_slots);
+		m_slots.resize(old.size() * 2);
+		for (const Slot& slot : old) {
+			if (slot.epoch != m_epoch) continue;
+			m_slots[find(slot.sym)] = slot;
+		}
+	}
+
+	std::vector<Slot> m_slots;
+	/// Slots taken in the current epoch
+	size_t m_used;
+	uint32_t m_epoch;
+	std::vector<Undo> m_undo;
+};
+
+#endif /* ifndef SYMTAB_HPP */
@@ -0,0 +1,174 @@
+#include "tiering.hpp"
+#include "ast.hpp"
+#include "options.hpp"
+
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+extern std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
+
+/// All profiles ever handed out (tier 0 code points into them)
+static std::deque<std::unique_ptr<TierProfile> > Profiles;
+
+/// The profile of the latest 'def' of every tiered function.
+/// Guards the stubs and the profiles too, so an old definition never
+/// overwrites a new one.
+static std::unordered_map<Symbol, TierProfile*> CurrentProfiles;
+/// Bumped by every 'def' of a function behind a stub. Code compiled for an
+/// older generation never gets to point the stub at it.
+static std::unordered_map<Symbol, uint64_t> Generations;
+static std::mutex StubsMutex;
+
+/// Functions waiting for tier 1
+static std::deque<TierProfile*> HotQueue;
+static std::mutex HotQueueMutex;
+static std::condition_variable HotQueueCond;
+static bool StopWorker = false;
+static std::thread Worker;
+
+typedef std::chrono::duration<double, std::milli> ms;
+
+/// Compiles a hot function at tier 1 and points its stub at it.
+static void promote(TierProfile* profile) {
+	const std::string& name = profile->fun->name().str();
+	auto start = std::chrono::steady_clock::now();
+
+	auto M = CodegenIsolated(*profile->fun, "$tier1", 3, 2, nullptr);
+	if (! M) {
+		logError("Failed recompiling '" + name + "' at tier 1");
+		return;
+	}
+	auto H = TheJIT->addModule(std::move(M));
+	orc::TargetAddress addr = TheJIT->getSymbolAddressIn(H, name + "$tier1");
+
+	{
+		std::lock_guard<std::mutex> lock(StubsMutex);
+		if (CurrentProfiles[profile->fun->name()] != profile) return;
+		TheJIT->createStub(name, addr);
+	}
+
+	if (! TheOptions.quiet || TheOptions.time) {
+		auto end = std::chrono::steady_clock::now();
+		std::cerr << "; '" << name << "' promoted to tier 1 after "
+			<< TheOptions.tierThreshold << " calls/back edges, compiled in "
+			<< ms(end - start).count() << " ms" << std::endl;
+	}
+}
+
+static void tierUpWorker() {
+	for (;;) {
+		TierProfile* profile;
+		{
+			std::unique_lock<std::mutex> lock(HotQueueMutex);
+			HotQueueCond.wait(lock, [] { return StopWorker || ! HotQueue.empty(); });
+			if (StopWorker) return;
+			profile = HotQueue.front();
+			HotQueue.pop_front();
+		}
+		promote(profile);
+	}
+}
+
+/// Lets a running tier 1 compile finish before the JIT goes away.
+static void stopWorker() {
+	{
+		std::lock_guard<std::mutex> lock(HotQueueMutex);
+		StopWorker = true;
+	}
+	HotQueueCond.notify_one();
+	Worker.join();
+}
+
+uint64_t newStubGeneration(Symbol name) {
+	std::lock_guard<std::mutex> lock(StubsMutex);
+	return ++Generations[name];
+}
+
+/// Hands out a new profile for 'fun' (and starts the tiering thread).
+static TierProfile* newProfile(std::shared_ptr<FunctionAST> fun) {
+	std::lock_guard<std::mutex> lock(StubsMutex);
+	if (! Worker.joinable()) {
+		Worker = std::thread(tierUpWorker);
+		std::atexit(stopWorker);
+	}
+
+	Profiles.push_back(std::unique_ptr<TierProfile>(new TierProfile()));
+	TierProfile* profile = Profiles.back().get();
+	profile->count = 0;
+	profile->fun = fun;
+	return profile;
+}
+
+/// Generates the code behind the stub of 'fun' and points the stub at it,
+/// unless 'fun' was redefined since it got 'generation'.
+/// That's tier 0 code when tiering, code of the usual -O/-ipo level otherwise.
+/// Returns the address of the new code, 0 if codegen failed.
+static orc::TargetAddress compileStubTarget(std::shared_ptr<FunctionAST> fun, uint64_t generation) {
+	const std::string& name = fun->name().str();
+	TierProfile* profile = TheOptions.tiered ? newProfile(fun) : nullptr;
+	const std::string implName = name + (profile ? "$tier0" : "$impl");
+
+	auto M = profile
+		? CodegenIsolated(*fun, "$tier0", 0, 0, profile)
+		: CodegenIsolated(*fun, "$impl", TheOptions.optLevel, TheOptions.ipoLevel, nullptr);
+	if (! M) return 0;
+	if (! TheOptions.quiet) M->dump();
+
+	// Tier 0 code calls itself through the stub, so it has to exist
+	// before the module gets linked.
+	if (! TheJIT->hasStub(name)) TheJIT->createStub(name, 0);
+	auto H = TheJIT->addModule(std::move(M));
+	orc::TargetAddress addr = TheJIT->getSymbolAddressIn(H, implName);
+
+	std::lock_guard<std::mutex> lock(StubsMutex);
+	// A late compile of an old body still serves the call that asked for it
+	if (Generations[fun->name()] != generation) return addr;
+	TheJIT->createStub(name, addr);
+	if (profile) CurrentProfiles[fun->name()] = profile;
+	return addr;
+}
+
+bool addTieredFunction(std::shared_ptr<FunctionAST> fun, uint64_t generation) {
+	return compileStubTarget(fun, generation) != 0;
+}
+
+bool addLazyFunction(std::shared_ptr<FunctionAST> fun) {
+	// Callers only need the prototype to declare the function
+	addFunctionProto(fun->proto());
+
+	// Runs on the thread that made the first call, right inside that call
+	uint64_t generation = newStubGeneration(fun->name());
+	orc::TargetAddress callback = TheJIT->createCompileCallback([fun, generation]() {
+		auto start = std::chrono::steady_clock::now();
+		orc::TargetAddress addr = compileStubTarget(fun, generation);
+		if (addr == 0) {
+			logError("Failed compiling '" + fun->name().str() + "' on its first call");
+			exit(EXIT_FAILURE);
+		}
+		if (TheOptions.time) {
+			auto end = std::chrono::steady_clock::now();
+			std::cerr << "; '" << fun->name() << "' compiled on its first call in "
+				<< ms(end - start).count() << " ms" << std::endl;
+		}
+		return addr;
+	});
+
+	std::lock_guard<std::mutex> lock(StubsMutex);
+	if (Generations[fun->name()] != generation) return true;
+	TheJIT->createStub(fun->name().str(), callback);
+	CurrentProfiles.erase(fun->name());
+	return true;
+}
+
+extern "C" void kal_tier_up(void* profile) {
+	{
+		std::lock_guard<std::mutex> lock(HotQueueMutex);
+		HotQueue.push_back(static_cast<TierProfile*>(profile));
+	}
+	HotQueueCond.notify_one();
+}
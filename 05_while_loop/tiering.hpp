@@ -0,0 +1,49 @@
+#ifndef TIERING_HPP
+#define TIERING_HPP
+
+#include <cstdint>
+#include <memory>
+
+#include "symbols.hpp"
+
+/// Functions called through indirection stubs: tiered and lazy compilation.
+///
+/// Every such 'def' gets a stub named like the function, and the code behind
+/// the stub can be swapped at any time.
+///
+/// Tiered compilation (-tiered): the body behind the stub is first compiled
+/// at -O0 (tier 0), with a counter that is bumped on every call and loop back
+/// edge. When the counter reaches the threshold (-tier-threshold) the function
+/// is compiled again at -O3, with the module pipeline, on a background thread
+/// (tier 1) and the stub is pointed at the new body.
+///
+/// Lazy compilation (-lazy): the stub first points at a compile callback, so
+/// nothing is compiled until the first call. The callback compiles the body
+/// (at tier 0 when tiering) and points the stub at it.
+
+class FunctionAST;
+
+/// Per function profile of tier 0 code.
+/// Tier 0 code updates 'count' directly, so profiles are never freed.
+struct TierProfile {
+	uint64_t count;
+	std::shared_ptr<FunctionAST> fun;
+};
+
+/// Returns the generation of a new 'def' of 'name'. Code compiled for an
+/// older generation is never put behind the stub.
+uint64_t newStubGeneration(Symbol name);
+
+/// Compiles 'fun' at tier 0 and points its stub at it, unless a 'def' of
+/// a later 'generation' came meanwhile. Returns false if codegen failed.
+bool addTieredFunction(std::shared_ptr<FunctionAST> fun, uint64_t generation);
+
+/// Points the stub of 'fun' at a compile callback, 'fun' is compiled on its
+/// first call. Returns false if the function can't be added.
+bool addLazyFunction(std::shared_ptr<FunctionAST> fun);
+
+/// Called by tier 0 code once its counter reaches the threshold.
+/// Queues the function for tier 1.
+extern "C" void kal_tier_up(void* profile);
+
+#endif /* ifndef TIERING_HPP */
@@ -0,0 +1,177 @@
+#include "types.hpp"
+#include "ast.hpp"
+
+#include <cmath>
+
+TypeInference::TypeInference(const FunctionAST& fun, KalType paramType)
+	: m_name(fun.name()), m_arity(fun.proto().args().size()),
+	  m_intBody(paramType == KalInt), m_return(KalBool)
+{
+	for (auto& arg : fun.proto().args())
+		m_params.push_back(&arg);
+
+	// Types only grow and there are three of them, so this ends
+	do {
+		m_changed = false;
+		m_callsOut = false;
+		m_scope.clear();
+		m_intCalls.clear();
+		for (auto& arg : fun.proto().args())
+			declare(arg, &arg, paramType);
+
+		KalType body = fun.body()->inferType(*this);
+		if (joinTypes(m_return, body) != m_return) {
+			m_return = joinTypes(m_return, body);
+			m_changed = true;
+		}
+	} while (m_changed);
+}
+
+KalType TypeInference::typeOf(const ExprAST* expr) const {
+	auto found = m_exprTypes.find(expr);
+	return found == m_exprTypes.end() ? KalDouble : found->second;
+}
+
+KalType TypeInference::variableType(const void* decl) const {
+	auto found = m_varTypes.find(decl);
+	return found == m_varTypes.end() ? KalDouble : found->second;
+}
+
+bool TypeInference::hasIntParameter() const {
+	for (auto param : m_params)
+		if (variableType(param) != KalDouble) return true;
+	return false;
+}
+
+KalType TypeInference::record(const ExprAST* expr, KalType type) {
+	m_exprTypes[expr] = type;
+	return type;
+}
+
+void TypeInference::join(const void* decl, KalType type) {
+	auto found = m_varTypes.find(decl);
+	if (found == m_varTypes.end()) {
+		m_varTypes[decl] = type;
+	} else if (joinTypes(found->second, type) != found->second) {
+		found->second = joinTypes(found->second, type);
+		m_changed = true;
+	}
+}
+
+const void* TypeInference::declare(Symbol name, const void* decl, KalType type) {
+	auto found = m_scope.find(name);
+	const void* shadowed = (found == m_scope.end() ? nullptr : found->second);
+	join(decl, type);
+	m_scope[name] = decl;
+	return shadowed;
+}
+
+void TypeInference::undeclare(Symbol name, const void* shadowed) {
+	if (shadowed == nullptr) m_scope.erase(name);
+	else m_scope[name] = shadowed;
+}
+
+void TypeInference::assign(Symbol name, KalType type) {
+	auto found = m_scope.find(name);
+	if (found != m_scope.end()) join(found->second, type);
+}
+
+KalType TypeInference::lookup(Symbol name) const {
+	auto found = m_scope.find(name);
+	return found == m_scope.end() ? KalDouble : variableType(found->second);
+}
+
+KalType TypeInference::call(const ExprAST* call, Symbol callee, const std::vector<KalType>& args) {
+	bool intCall = m_intBody && callee == m_name && args.size() == m_arity;
+	for (auto arg : args)
+		if (arg == KalDouble) intCall = false;
+	if (! intCall) {
+		m_callsOut = true;
+		return KalDouble;
+	}
+	m_intCalls.insert(call);
+	return m_return;
+}
+
+// ====----====----====----====----====----====----====----====----====----====
+// TYPE INFERENCE
+// ====----====----====----====----====----====----====----====----====----====
+KalType NumberExprAST::inferType(TypeInference& types) const {
+	// Bigger integers don't even fit a double exactly
+	const bool isInt = m_isInt && std::fabs(m_val) < 9007199254740992.0;
+	return types.record(this, isInt ? KalInt : KalDouble);
+}
+
+KalType VariableExprAST::inferType(TypeInference& types) const {
+	return types.record(this, types.lookup(m_name));
+}
+
+KalType BinaryExprAST::inferType(TypeInference& types) const {
+	if (m_op == '=') {
+		KalType value = m_right->inferType(types);
+		VariableExprAST* varAST = dynamic_cast<VariableExprAST*>(m_left);
+		if (varAST == nullptr) return types.record(this, value);
+		types.assign(varAST->name(), value);
+		// The value of an assignment is the value of the variable
+		return types.record(this, m_left->inferType(types));
+	}
+
+	KalType left = m_left->inferType(types);
+	KalType right = m_right->inferType(types);
+	switch (m_op) {
+		case ':': return types.record(this, right);
+		case '<':
+		case '>': return types.record(this, KalBool);
+		default: return types.record(this, types.arithmetic(left, right));
+	}
+}
+
+KalType VarDefExprAST::inferType(TypeInference& types) const {
+	std::vector<const void*> shadowed;
+	for (auto &ass : m_varDeclDefs) {
+		// Variables without an initializer start at 0
+		KalType init = ass.second ? ass.second->inferType(types) : KalInt;
+		shadowed.push_back(types.declare(ass.first, &ass, init));
+	}
+
+	KalType body = m_innerExpr->inferType(types);
+
+	for (unsigned i = m_varDeclDefs.size(); i-- > 0; )
+		types.undeclare(m_varDeclDefs[i].first, shadowed[i]);
+	return types.record(this, body);
+}
+
+KalType IfThenElseExprAST::inferType(TypeInference& types) const {
+	m_cond->inferType(types);
+	KalType thenType = m_thenExpr->inferType(types);
+	KalType elseType = m_elseExpr->inferType(types);
+	return types.record(this, joinTypes(thenType, elseType));
+}
+
+KalType ForExprAST::inferType(TypeInference& types) const {
+	KalType init = m_init->inferType(types);
+	const void* shadowed = types.declare(m_varName, this, init);
+
+	m_cond->inferType(types);
+	m_body->inferType(types);
+	// The loop variable gets the step added (1 without a step)
+	KalType step = m_step ? m_step->inferType(types) : KalInt;
+	types.assign(m_varName, types.arithmetic(types.lookup(m_varName), step));
+
+	types.undeclare(m_varName, shadowed);
+	// Loops are always 0
+	return types.record(this, KalInt);
+}
+
+KalType WhileExprAST::inferType(TypeInference& types) const {
+	m_cond->inferType(types);
+	m_body->inferType(types);
+	return types.record(this, KalInt);
+}
+
+KalType CallExprAST::inferType(TypeInference& types) const {
+	std::vector<KalType> args;
+	for (auto e : m_exps)
+		args.push_back(e->inferType(types));
+	return types.record(this, types.call(this, m_name, args));
+}
@@ -0,0 +1,99 @@
+#ifndef TYPES_HPP
+#define TYPES_HPP
+
+#include <map>
+#include <set>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "symbols.hpp"
+
+/// Static type inference (-infer-types).
+///
+/// Without it every value is a double. With it every function body is typed
+/// before codegen over the lattice bool < int < double: integer literals
+/// ('3', not '3.0') are ints, comparisons are bools, arithmetic takes the
+/// join of its operands (bools count as ints) and a variable takes the join
+/// of everything assigned to it, iterated to a fixpoint since loops assign
+/// back. bool, int and double are lowered to i1, i64 and double.
+///
+/// Functions still take and return doubles. A function with parameters that
+/// calls nothing but itself gets a second body, name$int, taking i64
+/// parameters: the double entry point calls it when every argument is an
+/// integer within +-2^53, and self calls with int arguments stay in it.
+/// Only the int body does integer math. Its ints stay within +-2^53, where
+/// doubles are exact, so it computes what doubles would: a result out of
+/// that range leaves the int body, and the entry point runs the double body
+/// from the start instead (with no calls out there is nothing to undo).
+
+class ExprAST;
+class FunctionAST;
+
+enum KalType { KalBool, KalInt, KalDouble };
+
+/// Least upper bound of two types
+inline KalType joinTypes(KalType a, KalType b) { return a > b ? a : b; }
+
+/// Type of arithmetic on 'a' and 'b' (bools count as ints)
+inline KalType arithmeticType(KalType a, KalType b) { return joinTypes(joinTypes(a, b), KalInt); }
+
+/// The types of one body of a function.
+class TypeInference {
+public:
+	/// Types the body of 'fun' with every parameter of type 'paramType'.
+	/// With KalInt it's the int body: self calls with int arguments stay in it.
+	TypeInference(const FunctionAST& fun, KalType paramType);
+
+	/// Type of the value of an expression (double if not typed).
+	KalType typeOf(const ExprAST* expr) const;
+	/// Type of a variable, by its declaration (see declare()).
+	KalType variableType(const void* decl) const;
+	/// Type the body returns
+	KalType returnType() const { return m_return; }
+	/// True if 'call' goes to the int body of the function itself
+	bool callsIntBody(const ExprAST* call) const { return m_intCalls.count(call) != 0; }
+	/// True if some parameter stays an int all over the body
+	bool hasIntParameter() const;
+	/// True if the body calls nothing but its own int body
+	bool isClosed() const { return ! m_callsOut; }
+
+	// Used by the inferType() methods of the nodes
+
+	/// Remembers and returns the type of 'expr'.
+	KalType record(const ExprAST* expr, KalType type);
+	/// Brings variable 'name' in scope, declared by 'decl' with a value of 'type'.
+	/// Returns the declaration it shadows, for undeclare().
+	const void* declare(Symbol name, const void* decl, KalType type);
+	void undeclare(Symbol name, const void* shadowed);
+	/// Joins 'type' into the type of variable 'name'.
+	void assign(Symbol name, KalType type);
+	/// Type of variable 'name' (double if there's no such variable).
+	KalType lookup(Symbol name) const;
+	/// Type of arithmetic on 'a' and 'b': int math is for the int body only.
+	KalType arithmetic(KalType a, KalType b) const { return m_intBody ? arithmeticType(a, b) : KalDouble; }
+	/// Type returned by 'call' to 'callee' with arguments of types 'args'.
+	KalType call(const ExprAST* call, Symbol callee, const std::vector<KalType>& args);
+
+private:
+	/// Joins 'type' into the type of 'decl', notes if it changed.
+	void join(const void* decl, KalType type);
+
+	Symbol m_name;
+	size_t m_arity;
+	bool m_intBody;
+	KalType m_return;
+	/// Set by every pass in which a variable type (or the return type) grew
+	bool m_changed;
+	/// Set by a call other than to the int body, in the last pass
+	bool m_callsOut;
+
+	std::map<const ExprAST*, KalType> m_exprTypes;
+	std::map<const void*, KalType> m_varTypes;
+	/// Declaration of every variable in scope
+	std::unordered_map<Symbol, const void*> m_scope;
+	std::vector<const void*> m_params;
+	std::set<const ExprAST*> m_intCalls;
+};
+
+#endif /* ifndef TYPES_HPP */
@@ -0,0 +1,145 @@
+#include "workers.hpp"
+#include "ast.hpp"
+#include "options.hpp"
+#include "stats.hpp"
+#include "tiering.hpp"
+
+#include <condition_variable>
+#include <cstdlib>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+
+extern std::unique_ptr<orc::KaleidoscopeJIT> TheJIT;
+
+static Statistic NumStale("workers", "bodies dropped for a later def compiled first");
+
+/// A queued 'def'
+struct Job {
+	std::shared_ptr<FunctionAST> fun;
+	uint64_t generation;
+};
+
+static std::vector<std::thread> Workers;
+static std::deque<Job> Queue;
+/// Queued plus being compiled
+static unsigned Pending = 0;
+static bool StopWorkers = false;
+/// Failed since the last waitForWorkers()
+static std::vector<std::shared_ptr<FunctionAST> > Failed;
+/// Generation of the latest 'def' queued, by name
+static std::unordered_map<Symbol, uint64_t> Generations;
+static std::mutex QueueMutex;
+static std::condition_variable QueueCond;
+static std::condition_variable DoneCond;
+
+/// The body of a function in the JIT. Its mutex orders the bodies of one
+/// function going to the JIT, those of different functions go in parallel.
+struct InstalledBody {
+	InstalledBody() : generation(0) {}
+	std::mutex mutex;
+	uint64_t generation;
+};
+static std::unordered_map<Symbol, std::unique_ptr<InstalledBody> > InstalledBodies;
+static std::mutex InstalledBodiesMutex;
+
+/// Keeps the IR dumps of different workers apart
+static std::mutex DumpMutex;
+
+static InstalledBody& installedBody(Symbol name) {
+	std::lock_guard<std::mutex> lock(InstalledBodiesMutex);
+	std::unique_ptr<InstalledBody>& body = InstalledBodies[name];
+	if (! body) body.reset(new InstalledBody());
+	return *body;
+}
+
+/// Returns false if codegen failed.
+static bool compile(const Job& job) {
+	const FunctionAST& fun = *job.fun;
+	if (TheOptions.tiered) return addTieredFunction(job.fun, job.generation);
+
+	auto M = CodegenIsolated(fun, "", TheOptions.optLevel, TheOptions.ipoLevel, nullptr);
+	if (! M) return false;
+	if (! TheOptions.quiet) {
+		std::lock_guard<std::mutex> lock(DumpMutex);
+		M->dump();
+	}
+
+	InstalledBody& body = installedBody(fun.name());
+	std::lock_guard<std::mutex> lock(body.mutex);
+	if (body.generation > job.generation) {
+		++NumStale;
+		return true;
+	}
+	body.generation = job.generation;
+	TheJIT->addModule(std::move(M));
+	return true;
+}
+
+static void worker() {
+	for (;;) {
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(QueueMutex);
+			QueueCond.wait(lock, [] { return StopWorkers || ! Queue.empty(); });
+			if (StopWorkers) return;
+			job = Queue.front();
+			Queue.pop_front();
+		}
+
+		bool ok = compile(job);
+
+		std::lock_guard<std::mutex> lock(QueueMutex);
+		if (! ok) Failed.push_back(job.fun);
+		if (--Pending == 0) DoneCond.notify_all();
+	}
+}
+
+/// Lets running compiles finish before the JIT goes away.
+static void stopWorkers() {
+	{
+		std::lock_guard<std::mutex> lock(QueueMutex);
+		StopWorkers = true;
+	}
+	QueueCond.notify_all();
+	for (auto &w : Workers) w.join();
+}
+
+void startWorkers(unsigned jobs) {
+	for (unsigned i = 0; i < jobs; ++i)
+		Workers.push_back(std::thread(worker));
+	std::atexit(stopWorkers);
+}
+
+void compileInBackground(std::shared_ptr<FunctionAST> fun) {
+	// Stubs keep their own generations
+	uint64_t generation = TheOptions.tiered ? newStubGeneration(fun->name()) : 0;
+	{
+		std::lock_guard<std::mutex> lock(QueueMutex);
+		if (! TheOptions.tiered) generation = ++Generations[fun->name()];
+		Queue.push_back(Job{fun, generation});
+		++Pending;
+	}
+	QueueCond.notify_one();
+}
+
+std::vector<Symbol> waitForWorkers() {
+	std::vector<std::shared_ptr<FunctionAST> > failed;
+	{
+		std::unique_lock<std::mutex> lock(QueueMutex);
+		DoneCond.wait(lock, [] { return Pending == 0; });
+		failed.swap(Failed);
+	}
+
+	// On the parser thread, after it registered the 'def'
+	std::vector<Symbol> names;
+	for (auto& fun : failed) {
+		logError("Failed compiling '" + fun->name().str() + "' in the background");
+		// Unless it was defined again meanwhile
+		if (findFunctionDef(fun->name()) != fun) continue;
+		forgetFunction(fun->name());
+		names.push_back(fun->name());
+	}
+	return names;
+}
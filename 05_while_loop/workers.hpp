@@ -0,0 +1,35 @@
+#ifndef WORKERS_HPP
+#define WORKERS_HPP
+
+#include <memory>
+#include <vector>
+
+#include "symbols.hpp"
+
+/// Background compilation (-jobs=<n>).
+///
+/// 'def's are handed to a pool of worker threads, each generating code in
+/// its own LLVMContext and modules, so the parser never waits for codegen
+/// of a definition. Top-level expressions are still compiled and run on the
+/// parser thread, but before linking they wait for every definition parsed
+/// before them.
+///
+/// Every queued 'def' gets a generation: when two 'def's of one function
+/// are compiled at once, the later one ends up in the JIT whichever
+/// finishes first. A 'def' that fails to compile is reported once the
+/// parser waits for it, and the function is forgotten.
+
+class FunctionAST;
+
+/// Starts 'jobs' worker threads.
+void startWorkers(unsigned jobs);
+
+/// Queues 'fun' for compilation. Its prototype must be known already.
+void compileInBackground(std::shared_ptr<FunctionAST> fun);
+
+/// Blocks until everything queued so far is compiled and in the JIT.
+/// Returns the functions that failed to compile since the last call
+/// (reported and forgotten already).
+std::vector<Symbol> waitForWorkers();
+
+#endif /* ifndef WORKERS_HPP */